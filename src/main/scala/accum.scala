@@ -0,0 +1,108 @@
+package dma
+
+import Chisel._
+
+object AccumOps {
+  val add = UInt(0)
+  val min = UInt(1)
+  val max = UInt(2)
+  val xor = UInt(3)
+}
+
+// 3 is reserved, and the sender refuses puts that use it
+object AccumTypes {
+  val int32   = UInt(0)
+  val int64   = UInt(1)
+  val float32 = UInt(2)
+}
+
+// Element-wise combining of a beat already in memory with a received one,
+// for accumulating puts. Integers are signed and wrap on overflow.
+// Float sums round to nearest even, and min and max ignore a NaN operand.
+object Accumulate {
+  val canonicalNaN = UInt("h7FC00000", 32)
+
+  def isNaN(x: UInt): Bool = x(30, 23).andR && x(22, 0).orR
+  def isInf(x: UInt): Bool = x(30, 23).andR && !x(22, 0).orR
+
+  // an unsigned integer that sorts the same way as the float
+  def orderKey(x: UInt): UInt = Mux(x(31), ~x, Cat(Bool(true), x(30, 0)))
+
+  def fadd(a: UInt, b: UInt): UInt = {
+    // x is the operand with the larger magnitude
+    val swap = a(30, 0) < b(30, 0)
+    val x = Mux(swap, b, a)
+    val y = Mux(swap, a, b)
+    def exp(f: UInt) = Mux(f(30, 23) === UInt(0), UInt(1, 8), f(30, 23))
+    def sig(f: UInt) = Cat(f(30, 23) != UInt(0), f(22, 0))
+    val x_exp = exp(x)
+    val sub = x(31) ^ y(31)
+
+    // line y up with x, keeping guard and round bits and
+    // folding everything shifted out past them into a sticky bit
+    val dist = x_exp - exp(y)
+    val y_wide = Cat(sig(y), UInt(0, 30)) >>
+      Mux(dist > UInt(27), UInt(27), dist(4, 0))
+    val y_sig = Cat(y_wide(53, 28), y_wide(27, 0).orR)
+    val x_sig = Cat(UInt(0, 1), sig(x), UInt(0, 3))
+    val sum = Mux(sub, x_sig - y_sig, x_sig + y_sig)
+
+    // a carry shifts right by one; otherwise shift the leading one up,
+    // but not below the smallest exponent, which leaves a denormal
+    val carry = sum(27)
+    val lz = PriorityEncoder(Reverse(sum(26, 0)))
+    val lz_max = x_exp - UInt(1)
+    val lshift = Mux(lz > lz_max, lz_max, lz)
+    val norm = Mux(carry, Cat(sum(27, 2), sum(1) | sum(0)),
+                          (sum(26, 0) << lshift(4, 0))(26, 0))
+    val norm_exp = Mux(carry, Cat(UInt(0, 2), x_exp) + UInt(1),
+                              Cat(UInt(0, 2), x_exp) - lshift)
+
+    val round_up = norm(2) && (norm(1) || norm(0) || norm(3))
+    val rounded = Cat(UInt(0, 1), norm(26, 3)) + round_up
+    val r_exp = Mux(rounded(24), norm_exp + UInt(1),
+                Mux(rounded(23), norm_exp, UInt(0)))
+    val r_frac = Mux(rounded(24), rounded(23, 1), rounded(22, 0))
+    val finite = Mux(r_exp >= UInt(255),
+      Cat(x(31), UInt(255, 8), UInt(0, 23)),
+      Cat(x(31), r_exp(7, 0), r_frac))
+
+    Mux(isNaN(a) || isNaN(b) || (isInf(a) && isInf(b) && sub), canonicalNaN,
+    Mux(isInf(a), a,
+    Mux(isInf(b), b,
+    Mux(sum === UInt(0), Cat(a(31) && b(31), UInt(0, 31)), finite))))
+  }
+
+  def int(op: UInt, old: UInt, in: UInt): UInt = {
+    val less = old.toSInt < in.toSInt
+    MuxLookup(op, old ^ in, Seq(
+      AccumOps.add -> (old + in),
+      AccumOps.min -> Mux(less, old, in),
+      AccumOps.max -> Mux(less, in, old)))
+  }
+
+  def float(op: UInt, old: UInt, in: UInt): UInt = {
+    val less = orderKey(old) < orderKey(in)
+    def pick(take_old: Bool) =
+      Mux(isNaN(old) && isNaN(in), canonicalNaN,
+      Mux(isNaN(in), old,
+      Mux(isNaN(old), in,
+      Mux(take_old, old, in))))
+    MuxLookup(op, old ^ in, Seq(
+      AccumOps.add -> fadd(old, in),
+      AccumOps.min -> pick(less),
+      AccumOps.max -> pick(!less)))
+  }
+
+  def apply(op: UInt, typ: UInt, old: Bits, in: Bits): Bits = {
+    val width = old.getWidth
+    require(width % 64 == 0)
+    def lanes(w: Int, f: (UInt, UInt) => UInt) =
+      Vec.tabulate(width / w) { i =>
+        f(old(w * i + w - 1, w * i), in(w * i + w - 1, w * i))
+      }.toBits
+    MuxLookup(typ, lanes(32, int(op, _, _)), Seq(
+      AccumTypes.int64 -> lanes(64, int(op, _, _)),
+      AccumTypes.float32 -> lanes(32, float(op, _, _))))
+  }
+}
@@ -24,6 +24,35 @@ object DMACSRs {
   val SENDER_PORT  = 9
   val TX_ERROR     = 10
   val PHYS         = 11
+  val NACK_RETRIES = 12
+  val NACK_BACKOFF = 13
+  val BYTES_DONE   = 14
+  val CACHE_ALLOC  = 15
+  val TX_CRC       = 16
+  val RX_CRC       = 17
+  val TRANSPOSE    = 18
+  val TRACE_BASE   = 19
+  val TRACE_SIZE   = 20
+  val TRACE_HEAD   = 21
+  val TRACE_DROPS  = 22
+  // the window registers other than the index and the check
+  // enable access the window selected by WINDOW_INDEX
+  val WINDOW_INDEX = 23
+  val WINDOW_BASE  = 24
+  val WINDOW_SIZE  = 25
+  val WINDOW_PORT  = 26
+  val WINDOW_KEY   = 27
+  val WINDOW_PERM  = 28
+  val WINDOW_CHECK = 29
+  val WINDOW_REJECTS = 30
+  // written by the kernel on every context switch
+  val CONTEXT_ASID = 31
+  val CONTEXT_RELEASE = 32
+  val ACCUM        = 33
+  // any write drops the receiver's cached translations
+  val TLB_FLUSH    = 34
+  // read-only, set while trace records are waiting to be written
+  val TRACE_PENDING = 35
 }
 
 import DMACSRs._
@@ -35,20 +64,45 @@ class DMACSRs extends DMABundle {
   val nsegments = UInt(width = paddrBits)
   val header = new RemoteHeader
   val phys = Bool()
+  val alloc = Bool()
+  val transpose = Bool()
+  val elem_size = UInt(width = 2)
+  val accum = Bool()
+  val accum_op = UInt(width = 2)
+  val accum_type = UInt(width = 2)
+  val max_retries = UInt(width = 8)
+  val backoff = UInt(width = 16)
 }
 
 class SegmentSenderCommand extends DMABundle {
   val dst = UInt(width = paddrBits)
   val src = UInt(width = paddrBits)
   val direction = Bool()
+  val ctx = UInt(width = log2Up(nContexts))
+}
+
+// an instruction from the core, tagged with the context
+// that was active when the core handed it over
+class CopyAccelCommand extends DMABundle {
+  val funct = Bits(width = 7)
+  val rs1 = Bits(width = xLen)
+  val rs2 = Bits(width = xLen)
+  val ctx = UInt(width = log2Up(nContexts))
 }
 
 class SegmentSender extends DMAModule {
   val io = new Bundle {
     val cmd = Decoupled(new SegmentSenderCommand).flip
     val csrs = (new DMACSRs).asInput
+    // the context whose CSRs should be on io.csrs
+    val ctx = UInt(OUTPUT, log2Up(nContexts))
     val dma = Decoupled(new TileLinkDMACommand)
     val busy = Bool(OUTPUT)
+    // a command has been dealt with
+    val done = Bool(OUTPUT)
+    // ... by refusing it, with nothing sent
+    val rejected = Bool(OUTPUT)
+    val trace = Valid(new TraceEvent)
   }
 
   val s_idle :: s_req :: s_wait :: Nil = Enum(Bits(), 3)
@@ -57,16 +111,26 @@ class SegmentSender extends DMAModule {
   val cmd = Queue(io.cmd, dmaQueueDepth)
   cmd.ready := (state === s_idle)
 
+  val ctx = Reg(UInt(width = log2Up(nContexts)))
+  io.ctx := Mux(state === s_idle, cmd.bits.ctx, ctx)
+
   io.busy := (state != s_idle) || cmd.valid
 
   val src = Reg(UInt(width = paddrBits))
   val dst = Reg(UInt(width = paddrBits))
   val segments_left = Reg(UInt(width = paddrBits))
   val direction = Reg(Bool())
+  val first = Reg(Bool())
   val xact_id = Reg(init = UInt(0, dmaXactIdBits))
   val src_step = Reg(UInt(width = paddrBits))
   val dst_step = Reg(UInt(width = paddrBits))
 
+  io.trace.valid := cmd.valid && cmd.ready
+  io.trace.bits.source := TraceSources.sender
+  io.trace.bits.code := UInt(0)
+  io.trace.bits.info := cmd.bits.direction
+  io.trace.bits.xact_id := xact_id
+
   io.dma.valid := (state === s_req)
   io.dma.bits.src_start := src
   io.dma.bits.dst_start := dst
@@ -74,27 +138,63 @@ class SegmentSender extends DMAModule {
   io.dma.bits.direction := direction
   io.dma.bits.header := io.csrs.header
   io.dma.bits.xact_id := xact_id
+  io.dma.bits.first := first
+  // only puts can be transposed, since the gathering is done locally
+  io.dma.bits.transpose := io.csrs.transpose && direction
+  io.dma.bits.elem_size := io.csrs.elem_size
+  io.dma.bits.elem_stride := io.csrs.src_stride
+  io.dma.bits.accum := io.csrs.accum && direction
+  io.dma.bits.accum_op := io.csrs.accum_op
+  io.dma.bits.accum_type := io.csrs.accum_type
 
   val nowork = io.csrs.segment_size === UInt(0) ||
                io.csrs.nsegments === UInt(0)
 
+  // an accumulating put needs a defined type, and every segment has to
+  // start and end on an element boundary, since the receiver combines
+  // whole elements
+  val accum_elem_mask = Mux(io.csrs.accum_type === AccumTypes.int64,
+    UInt(7), UInt(3))
+  val bad_accum = io.csrs.accum && cmd.bits.direction &&
+    (io.csrs.accum_type === UInt(3) ||
+     ((cmd.bits.dst | io.csrs.segment_size | io.csrs.dst_stride) &
+       accum_elem_mask) != UInt(0))
+  // a transposed put places whole elements, so its source, destination,
+  // pitches and segment size all have to be multiples of the element size
+  val transpose_elem_mask = (UInt(1) << io.csrs.elem_size) - UInt(1)
+  val bad_transpose = io.csrs.transpose && cmd.bits.direction &&
+    ((cmd.bits.src | cmd.bits.dst | io.csrs.src_stride |
+      io.csrs.dst_stride | io.csrs.segment_size) &
+      transpose_elem_mask) != UInt(0)
+  val reject = !nowork && (bad_accum || bad_transpose)
+
+  io.done := (state === s_idle && cmd.valid && (nowork || reject)) ||
+             (state === s_wait && io.dma.ready)
+  io.rejected := state === s_idle && cmd.valid && reject
+
   switch (state) {
     is (s_idle) {
       when (cmd.valid) {
         dst := cmd.bits.dst
         src := cmd.bits.src
         direction := cmd.bits.direction
+        ctx := cmd.bits.ctx
         dst_step := io.csrs.segment_size + io.csrs.dst_stride
-        src_step := io.csrs.segment_size + io.csrs.src_stride
+        // when transposing, each segment is the next column of the source
+        src_step := Mux(io.csrs.transpose && cmd.bits.direction,
+          UInt(1) << io.csrs.elem_size,
+          io.csrs.segment_size + io.csrs.src_stride)
         segments_left := io.csrs.nsegments
+        first := Bool(true)
 
-        when (!nowork) { state := s_req }
+        when (!nowork && !reject) { state := s_req }
       }
     }
     is (s_req) {
       when (io.dma.ready) {
         src := src + src_step
         dst := dst + dst_step
+        first := Bool(false)
         when (segments_left === UInt(1)) {
           state := s_wait
         }
@@ -122,11 +222,50 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
   initCsrs.src_stride := UInt(0)
   initCsrs.nsegments := UInt(0)
   initCsrs.phys := Bool(false)
+  initCsrs.alloc := Bool(true)
+  initCsrs.transpose := Bool(false)
+  initCsrs.elem_size := UInt(0)
+  initCsrs.accum := Bool(false)
+  initCsrs.accum_op := UInt(0)
+  initCsrs.accum_type := UInt(0)
+  initCsrs.max_retries := UInt(0)
+  initCsrs.backoff := UInt(0)
   initCsrs.header.dst.addr := UInt(0)
   initCsrs.header.dst.port := UInt(0)
   initCsrs.header.src.addr := UInt(0)
   initCsrs.header.src.port := UInt(0)
-  val csrs = Reg(init = initCsrs)
+
+  // Each context is the CSR state of one address space. The kernel
+  // writes the ASID of the process it switches to, which selects the
+  // context with that tag, or takes over a free or the least recently
+  // allocated one. Context 0 starts out as ASID 0.
+  val ctxBits = log2Up(nContexts)
+  val contexts = Vec.fill(nContexts) { Reg(init = initCsrs) }
+  val ctx_asid = Vec.fill(nContexts) { Reg(init = UInt(0, 16)) }
+  val ctx_valid = Vec.tabulate(nContexts) { i => Reg(init = Bool(i == 0)) }
+  val active = Reg(init = UInt(0, ctxBits))
+  val ctx_repl = Reg(init = UInt(0, ctxBits))
+  val csrs = contexts(active)
+
+  // transfer status of the contexts that are not using the transmitter
+  val ctx_error = Vec.fill(nContexts) { Reg(init = TxErrors.noerror) }
+  val ctx_bytes_done = Vec.fill(nContexts) { Reg(init = UInt(0, paddrBits)) }
+  val ctx_tx_crc = Vec.fill(nContexts) { Reg(init = UInt(0, 32)) }
+
+  val trace_base = Reg(init = UInt(0, paddrBits))
+  val trace_size = Reg(init = UInt(0, paddrBits))
+
+  val initWindow = new RxWindow
+  initWindow.base := UInt(0)
+  initWindow.size := UInt(0)
+  initWindow.port := UInt(0)
+  initWindow.key := UInt(0)
+  initWindow.read := Bool(false)
+  initWindow.write := Bool(false)
+  val windows = Vec.fill(nRxWindows) { Reg(init = initWindow) }
+  val window_index = Reg(init = UInt(0, log2Up(nRxWindows)))
+  val window = windows(window_index)
+  val check_windows = Reg(init = Bool(false))
 
   when (io.csrs.wen) {
     switch (io.csrs.waddr) {
@@ -139,6 +278,37 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
       is (UInt(REMOTE_ADDR))  { csrs.header.dst.addr := io.csrs.wdata }
       is (UInt(REMOTE_PORT))  { csrs.header.dst.port := io.csrs.wdata }
       is (UInt(PHYS))         { csrs.phys := (io.csrs.wdata != UInt(0)) }
+      is (UInt(CACHE_ALLOC))  { csrs.alloc := (io.csrs.wdata != UInt(0)) }
+      is (UInt(TRANSPOSE)) {
+        // written as the element size in bytes, or zero to turn off.
+        // sizes other than 1, 2, 4 and 8 also turn it off,
+        // so software can tell from reading it back
+        val elem_ok = io.csrs.wdata <= UInt(8) &&
+          (io.csrs.wdata & (io.csrs.wdata - UInt(1))) === UInt(0)
+        csrs.transpose := (io.csrs.wdata != UInt(0)) && elem_ok
+        csrs.elem_size := Log2(io.csrs.wdata(3, 0))
+      }
+      is (UInt(ACCUM)) {
+        // bit 4 turns it on, bits 3-2 are the type and 1-0 the operation
+        csrs.accum := io.csrs.wdata(4)
+        csrs.accum_type := io.csrs.wdata(3, 2)
+        csrs.accum_op := io.csrs.wdata(1, 0)
+      }
+      is (UInt(TRACE_BASE))   { trace_base := io.csrs.wdata }
+      is (UInt(TRACE_SIZE))   { trace_size := io.csrs.wdata }
+      is (UInt(NACK_RETRIES)) { csrs.max_retries := io.csrs.wdata }
+      is (UInt(NACK_BACKOFF)) { csrs.backoff := io.csrs.wdata }
+      is (UInt(WINDOW_INDEX)) { window_index := io.csrs.wdata }
+      is (UInt(WINDOW_BASE))  { window.base := io.csrs.wdata }
+      is (UInt(WINDOW_SIZE))  { window.size := io.csrs.wdata }
+      is (UInt(WINDOW_PORT))  { window.port := io.csrs.wdata }
+      is (UInt(WINDOW_KEY))   { window.key := io.csrs.wdata }
+      is (UInt(WINDOW_PERM)) {
+        // bit 0 allows gets, bit 1 allows puts
+        window.read := io.csrs.wdata(0)
+        window.write := io.csrs.wdata(1)
+      }
+      is (UInt(WINDOW_CHECK)) { check_windows := (io.csrs.wdata != UInt(0)) }
     }
   }
 
@@ -151,32 +321,190 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
   io.csrs.rdata(REMOTE_ADDR)  := csrs.header.dst.addr
   io.csrs.rdata(REMOTE_PORT)  := csrs.header.dst.port
   io.csrs.rdata(PHYS)         := csrs.phys
+  io.csrs.rdata(CACHE_ALLOC)  := csrs.alloc
+  io.csrs.rdata(TRANSPOSE)    := Mux(csrs.transpose,
+    UInt(1) << csrs.elem_size, UInt(0))
+  io.csrs.rdata(ACCUM)        := Cat(csrs.accum, csrs.accum_type, csrs.accum_op)
+  io.csrs.rdata(TRACE_BASE)   := trace_base
+  io.csrs.rdata(TRACE_SIZE)   := trace_size
+  io.csrs.rdata(NACK_RETRIES) := csrs.max_retries
+  io.csrs.rdata(NACK_BACKOFF) := csrs.backoff
+  io.csrs.rdata(WINDOW_INDEX) := window_index
+  io.csrs.rdata(WINDOW_BASE)  := window.base
+  io.csrs.rdata(WINDOW_SIZE)  := window.size
+  io.csrs.rdata(WINDOW_PORT)  := window.port
+  io.csrs.rdata(WINDOW_KEY)   := window.key
+  io.csrs.rdata(WINDOW_PERM)  := Cat(window.write, window.read)
+  io.csrs.rdata(WINDOW_CHECK) := check_windows
+  io.csrs.rdata(CONTEXT_ASID) := ctx_asid(active)
+  io.csrs.rdata(CONTEXT_RELEASE) := UInt(0)
+  io.csrs.rdata(TLB_FLUSH)    := UInt(0)
+
+  // the context is taken as each instruction arrives, so switching
+  // contexts doesn't change the one of instructions already queued
+  val cmd = Module(new Queue(new CopyAccelCommand, 2))
+  cmd.io.enq.valid := io.cmd.valid
+  cmd.io.enq.bits.funct := io.cmd.bits.inst.funct
+  cmd.io.enq.bits.rs1 := io.cmd.bits.rs1
+  cmd.io.enq.bits.rs2 := io.cmd.bits.rs2
+  cmd.io.enq.bits.ctx := active
+  io.cmd.ready := cmd.io.enq.ready
+  cmd.io.deq.ready := (state === s_idle)
 
   val src = Reg(UInt(width = paddrBits))
   val dst = Reg(UInt(width = paddrBits))
   val direction = Reg(Bool())
+  val cmd_ctx = Reg(UInt(width = ctxBits))
 
+  // queued commands keep the CSRs of the context that issued them
   val sender = Module(new SegmentSender)
-  sender.io.csrs := csrs
+  val sender_csrs = contexts(sender.io.ctx)
+  sender.io.csrs := sender_csrs
   sender.io.cmd.valid := (state === s_req_send)
   sender.io.cmd.bits.src := src
   sender.io.cmd.bits.dst := dst
   sender.io.cmd.bits.direction := direction
+  sender.io.cmd.bits.ctx := cmd_ctx
 
   val tx = Module(new TileLinkDMATx)
   tx.io.net <> io.net.tx
   tx.io.route_error := io.net.ctrl.route_error(0)
-  tx.io.phys := csrs.phys
+  tx.io.phys := sender_csrs.phys
+  tx.io.walk_ok := sender.io.ctx === active
+  tx.io.alloc := sender_csrs.alloc
+  tx.io.max_retries := sender_csrs.max_retries
+  tx.io.backoff := sender_csrs.backoff
   tx.io.cmd <> sender.io.dma
 
+  // The transmitter's status registers belong to the context of the
+  // last transfer. When another context starts one, they are saved
+  // (the transmitter is idle then, so they hold the final values).
+  val tx_ctx = Reg(init = UInt(0, ctxBits))
+  val tx_owned = Reg(init = Bool(false))
+  when (tx.io.cmd.fire() && tx.io.cmd.bits.first) {
+    when (tx_owned && tx_ctx != sender.io.ctx) {
+      ctx_error(tx_ctx) := tx.io.error
+      ctx_bytes_done(tx_ctx) := tx.io.bytes_done
+      ctx_tx_crc(tx_ctx) := tx.io.crc
+    }
+    tx_ctx := sender.io.ctx
+    tx_owned := Bool(true)
+  }
+  // a refused command counts as the context's last transfer
+  when (sender.io.rejected) {
+    ctx_error(sender.io.ctx) := TxErrors.invalid
+    ctx_bytes_done(sender.io.ctx) := UInt(0)
+    ctx_tx_crc(sender.io.ctx) := UInt(0)
+    when (tx_ctx === sender.io.ctx) { tx_owned := Bool(false) }
+  }
+  val tx_live = tx_owned && tx_ctx === active
+
+  // The status can be written back while the transmitter is idle, so
+  // that code borrowing the engine (like the memcpy shim) can restore
+  // what the application last saw.
+  val status_wen = io.csrs.wen &&
+    (io.csrs.waddr === UInt(TX_ERROR) ||
+     io.csrs.waddr === UInt(BYTES_DONE) ||
+     io.csrs.waddr === UInt(TX_CRC))
+  when (status_wen) {
+    when (tx_live) {
+      ctx_error(active) := tx.io.error
+      ctx_bytes_done(active) := tx.io.bytes_done
+      ctx_tx_crc(active) := tx.io.crc
+      tx_owned := Bool(false)
+    }
+    switch (io.csrs.waddr) {
+      is (UInt(TX_ERROR))   { ctx_error(active) := io.csrs.wdata }
+      is (UInt(BYTES_DONE)) { ctx_bytes_done(active) := io.csrs.wdata }
+      is (UInt(TX_CRC))     { ctx_tx_crc(active) := io.csrs.wdata }
+    }
+  }
+
+  // commands of each context from the time they arrive until the
+  // sender is done with them (or they turn out not to be transfers)
+  val ctx_pending = Vec.fill(nContexts) {
+    Reg(init = UInt(0, log2Up(dmaQueueDepth + 5))) }
+  val cmd_dropped = cmd.io.deq.fire() && cmd.io.deq.bits.funct(6, 1) != UInt(0)
+  for (i <- 0 until nContexts) {
+    val issued = cmd.io.enq.fire() && active === UInt(i)
+    val retired = (sender.io.done && sender.io.ctx === UInt(i)) ||
+      (cmd_dropped && cmd.io.deq.bits.ctx === UInt(i))
+    ctx_pending(i) := ctx_pending(i) + issued.toUInt - retired.toUInt
+  }
+
+  // A context is only taken over once the sender no longer needs its
+  // CSRs. If every context has commands in flight, the write is ignored
+  // (reading the ASID back shows it) and the kernel has to wait for one
+  // to drain before switching to a new address space.
+  val wasid = io.csrs.wdata(15, 0)
+  val ctx_hits = Vec.tabulate(nContexts) { i =>
+    ctx_valid(i) && ctx_asid(i) === wasid }
+  val ctx_idle = Vec.tabulate(nContexts) { i => ctx_pending(i) === UInt(0) }
+  val ctx_free = Vec.tabulate(nContexts) { i => !ctx_valid(i) && ctx_idle(i) }
+  val ctx_victim = Mux(ctx_free.toBits.orR, PriorityEncoder(ctx_free),
+    Mux(ctx_idle(ctx_repl), ctx_repl, PriorityEncoder(ctx_idle)))
+  val ctx_any_idle = ctx_idle.toBits.orR
+
+  when (io.csrs.wen && io.csrs.waddr === UInt(CONTEXT_ASID)) {
+    when (ctx_hits.toBits.orR) {
+      active := PriorityEncoder(ctx_hits)
+    } .elsewhen (ctx_any_idle) {
+      contexts(ctx_victim) := initCsrs
+      ctx_asid(ctx_victim) := wasid
+      ctx_valid(ctx_victim) := Bool(true)
+      ctx_error(ctx_victim) := TxErrors.noerror
+      ctx_bytes_done(ctx_victim) := UInt(0)
+      ctx_tx_crc(ctx_victim) := UInt(0)
+      when (tx_ctx === ctx_victim) { tx_owned := Bool(false) }
+      when (!ctx_free.toBits.orR) { ctx_repl := ctx_victim + UInt(1) }
+      active := ctx_victim
+    }
+  }
+
+  when (io.csrs.wen && io.csrs.waddr === UInt(CONTEXT_RELEASE)) {
+    for (i <- 0 until nContexts) {
+      when (ctx_hits(i)) { ctx_valid(i) := Bool(false) }
+    }
+  }
+
   val rx = Module(new TileLinkDMARx)
   rx.io.net <> io.net.rx
   rx.io.route_error := io.net.ctrl.route_error(1)
-  rx.io.phys := csrs.phys
-
-  val dmemArb = Module(new ClientUncachedTileLinkIOArbiter(2))
+  for (i <- 0 until nContexts) {
+    val c = rx.io.contexts(i)
+    c.valid := ctx_valid(i)
+    c.addr := contexts(i).header.src
+    c.phys := contexts(i).phys
+    c.alloc := contexts(i).alloc
+    c.active := active === UInt(i)
+  }
+  // writing anything to the receive checksum clears it
+  rx.io.crc_clear := io.csrs.wen && io.csrs.waddr === UInt(RX_CRC)
+  rx.io.windows := windows
+  rx.io.check_windows := check_windows
+  // cached translations may be stale once a window or the mode changes
+  rx.io.flush := io.csrs.wen &&
+    (io.csrs.waddr === UInt(PHYS) ||
+     io.csrs.waddr === UInt(CONTEXT_ASID) ||
+     io.csrs.waddr === UInt(TLB_FLUSH) ||
+     (io.csrs.waddr >= UInt(WINDOW_BASE) &&
+      io.csrs.waddr <= UInt(WINDOW_CHECK)))
+
+  val trace = Module(new DMATraceUnit(4))
+  trace.io.events(0) <> sender.io.trace
+  trace.io.events(1) <> tx.io.trace
+  trace.io.events(2) <> rx.io.trace
+  trace.io.events(3) <> tx.io.fill_trace
+  trace.io.base := trace_base
+  trace.io.size := trace_size
+  trace.io.head_write.valid := io.csrs.wen &&
+                               io.csrs.waddr === UInt(TRACE_HEAD)
+  trace.io.head_write.bits := io.csrs.wdata
+
+  val dmemArb = Module(new ClientUncachedTileLinkIOArbiter(3))
   dmemArb.io.in(0) <> tx.io.dmem
   dmemArb.io.in(1) <> rx.io.dmem
+  dmemArb.io.in(2) <> trace.io.dmem
   dmemArb.io.out <> io.dmem
 
   val ptwArb = Module(new PTWArbiter(2))
@@ -184,9 +512,6 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
   ptwArb.io.requestors(1) <> rx.io.dptw
   ptwArb.io.ptw <> io.dptw
 
-  val cmd = Queue(io.cmd)
-  cmd.ready := (state === s_idle)
-
   io.net.ctrl.cur_addr := csrs.header.src
   io.net.ctrl.switch_addr.ready := Bool(false)
 
@@ -194,16 +519,25 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
 
   io.csrs.rdata(SENDER_ADDR) := rx.io.remote_addr.addr
   io.csrs.rdata(SENDER_PORT) := rx.io.remote_addr.port
-  io.csrs.rdata(TX_ERROR)    := tx.io.error
+  io.csrs.rdata(TX_ERROR)    := Mux(tx_live, tx.io.error, ctx_error(active))
+  io.csrs.rdata(BYTES_DONE)  := Mux(tx_live,
+    tx.io.bytes_done, ctx_bytes_done(active))
+  io.csrs.rdata(TX_CRC)      := Mux(tx_live, tx.io.crc, ctx_tx_crc(active))
+  io.csrs.rdata(RX_CRC)      := rx.io.crc
+  io.csrs.rdata(TRACE_HEAD)  := trace.io.head
+  io.csrs.rdata(TRACE_DROPS) := trace.io.dropped
+  io.csrs.rdata(TRACE_PENDING) := trace.io.pending
+  io.csrs.rdata(WINDOW_REJECTS) := rx.io.rejects
 
   switch (state) {
     is (s_idle) {
-      when (cmd.valid) {
-        val funct = cmd.bits.inst.funct
+      when (cmd.io.deq.valid) {
+        val funct = cmd.io.deq.bits.funct
         when (funct(6, 1) === UInt(0)) {
-          dst := cmd.bits.rs1
-          src := cmd.bits.rs2
+          dst := cmd.io.deq.bits.rs1
+          src := cmd.io.deq.bits.rs2
           direction := !funct(0)
+          cmd_ctx := cmd.io.deq.bits.ctx
           state := s_req_send
         }
       }
@@ -215,7 +549,7 @@ class CopyAccelerator extends RoCC with DMAParameters with TileLinkParameters {
     }
   }
 
-  io.busy := (state != s_idle) || cmd.valid || sender.io.busy
+  io.busy := (state != s_idle) || cmd.io.deq.valid || sender.io.busy
 
   io.resp.valid := Bool(false)
   io.mem.req.valid := Bool(false)
@@ -0,0 +1,66 @@
+package dma
+
+import Chisel._
+
+// CRC32C (Castagnoli), computed over the bytes of a beat
+// that are enabled in the byte mask, lowest byte first
+object CRC32C {
+  val init = UInt("hFFFFFFFF", 32)
+
+  // the reflected CRC is linear over GF(2), so rather than folding in
+  // a bit at a time (8 steps per byte, all in one cycle) each update is
+  // a few fixed xor trees. these work out their inputs at elaboration
+  private val polyBits = 0x82F63B78L
+
+  private def shift(c: Long): Long =
+    (c >>> 1) ^ (if ((c & 1) != 0) polyBits else 0L)
+
+  private def unshift(c: Long): Long = {
+    val b = (c >>> 31) & 1
+    (((c ^ (if (b != 0) polyBits else 0L)) << 1) & 0xFFFFFFFFL) | b
+  }
+
+  private def times(f: Long => Long, n: Int)(c: Long): Long =
+    (0 until n).foldLeft(c) { (x, _) => f(x) }
+
+  private def xorTree(bits: Seq[Bool]): Bool =
+    if (bits.isEmpty) Bool(false)
+    else if (bits.size == 1) bits.head
+    else {
+      val (a, b) = bits.splitAt(bits.size / 2)
+      xorTree(a) ^ xorTree(b)
+    }
+
+  // images(j) is where input bit j ends up
+  private def mul(images: Seq[Long], x: UInt): UInt =
+    Vec.tabulate(32) { r =>
+      xorTree(images.zipWithIndex.filter(m => ((m._1 >>> r) & 1) != 0)
+                                 .map(m => x(m._2)))
+    }.toBits.toUInt
+
+  private def matrix(f: Long => Long): Seq[Long] =
+    (0 until 32).map(j => f(1L << j))
+
+  // the enabled bytes must be contiguous, as they are in every block
+  // the engine moves. the state is shifted in at the first enabled byte
+  // and the data from zero, then the trailing disabled bytes, which
+  // were run through as zeros, are shifted back out
+  def apply(crc: UInt, data: Bits, mask: Bits): UInt = {
+    val nbytes = data.getWidth / 8
+    val lead = PriorityEncoder(mask)
+    val trail = PriorityEncoder(Reverse(mask))
+
+    val data_images = for (i <- 0 until nbytes; b <- 0 until 8)
+      yield times(shift, 8 * (nbytes - i))(1L << b)
+    val spread = mul(data_images, (data & FillInterleaved(8, mask)).toUInt)
+    val state = Vec.tabulate(nbytes) { i =>
+      mul(matrix(times(shift, 8 * (nbytes - i))), crc)
+    }
+    val sum = state(lead) ^ spread
+    val result = Vec.tabulate(nbytes) { t =>
+      mul(matrix(times(unshift, 8 * t)), sum)
+    }
+
+    Mux(mask.orR, result(trail), crc)
+  }
+}
@@ -16,6 +16,12 @@ trait DMAParameters extends UsesParameters {
   val dmaXactIdBits = log2Up(dmaMaxXacts)
   val dmaQueueDepth = params(DMAQueueDepth)
   val lnHeaderBits = params(LNHeaderBits)
+  val nRxWindows = 4
+  // blocks the transmitter can stage ahead of the destination
+  val nTxBufferBlocks = 4
+  // element gets a transposed put keeps in flight
+  val nElemXacts = 4
+  val nContexts = 4
 }
 
 abstract class DMAModule extends Module
@@ -25,10 +31,23 @@ abstract class DMABundle extends Bundle
   with DMAParameters with CoreParameters with TileLinkParameters
 
 object TxErrors {
-  val noerror     = Bits("b00")
-  val pageFault   = Bits("b01")
-  val nack        = Bits("b10")
-  val noRoute     = Bits("b11")
+  val noerror     = Bits("b000")
+  val pageFault   = Bits("b001")
+  val nack        = Bits("b010")
+  val noRoute     = Bits("b011")
+  // the command was malformed and nothing was sent
+  val invalid     = Bits("b100")
+}
+
+object RemoteAcquire {
+  // Acquire types 6 and 7 are not used by the built-in types,
+  // so we use one of them to request a stream of consecutive blocks.
+  // The number of blocks is carried in the data field of the acquire.
+  val getStreamType = UInt("b110")
+  // A put block whose data is combined with the destination instead of
+  // overwriting it. The union holds a mask of the 32-bit elements of the
+  // beat, the element type and the operation (see accum.scala).
+  val putAccumType = UInt("b111")
 }
 
 class TileLinkDMACommand extends DMABundle {
@@ -38,6 +57,120 @@ class TileLinkDMACommand extends DMABundle {
   val header = new RemoteHeader
   val xact_id = UInt(width = dmaXactIdBits)
   val direction = Bool()
+  val first = Bool()
+  // in transpose mode, the source is a column of elements
+  // of size 1 << elem_size that are elem_stride bytes apart
+  val transpose = Bool()
+  val elem_size = UInt(width = 2)
+  val elem_stride = UInt(width = paddrBits)
+  // puts only: combine with the destination elements
+  val accum = Bool()
+  val accum_op = UInt(width = 2)
+  val accum_type = UInt(width = 2)
+}
+
+// A range of local memory that remote senders may access through a port.
+// If key is nonzero, only a sender bound to port key may use it.
+class RxWindow extends DMABundle {
+  val base = UInt(width = paddrBits)
+  val size = UInt(width = paddrBits)
+  val port = new RemoteAddress().port.cloneType
+  val key = new RemoteAddress().port.cloneType
+  val read = Bool()
+  val write = Bool()
+}
+
+// What the receiver needs to know about a hardware context.
+// A request belongs to the context bound to its destination port.
+class RxContext extends DMABundle {
+  val valid = Bool()
+  val addr = new RemoteAddress
+  val phys = Bool()
+  val alloc = Bool()
+  val active = Bool()
+}
+
+class TxStagingWrite extends DMABundle {
+  val beat = UInt(width = paddrBits)
+  val data = Bits(width = tlDataBits)
+}
+
+class TxStagingStart extends DMABundle {
+  val beat = UInt(width = paddrBits)
+  val shift = UInt(width = tlByteAddrBits)
+}
+
+// Staging buffer for the transmitter. Beats are written into an SRAM ring
+// in stream order and read back out in order, each output beat made of
+// two consecutive staged beats shifted right by shift bytes. The read side
+// runs ahead into a small output queue; starting it again flushes that.
+class TxStagingBuffer(nBlocks: Int) extends DMAModule {
+  val io = new Bundle {
+    val write = Valid(new TxStagingWrite).flip
+    val start = Valid(new TxStagingStart).flip
+    // beats below this one have been written
+    val avail = UInt(INPUT, paddrBits)
+    val out = Decoupled(Bits(width = tlDataBits))
+  }
+
+  private val nBeats = nBlocks * tlDataBeats
+  private val idxBits = log2Up(nBeats)
+
+  require(isPow2(nBeats))
+
+  val buffer = Mem(Bits(width = tlDataBits), nBeats, seqRead = true)
+
+  when (io.write.valid) {
+    buffer(io.write.bits.beat(idxBits - 1, 0)) := io.write.bits.data
+  }
+
+  val shift = Reg(UInt(width = tlByteAddrBits))
+  val read_beat = Reg(UInt(width = paddrBits))
+  val read_idx = Reg(UInt(width = idxBits))
+  // prev will hold the beat before the one being read
+  val primed = Reg(init = Bool(false))
+  val s1_valid = Reg(init = Bool(false))
+  val s1_primed = Reg(Bool())
+  val prev = Reg(Bits(width = tlDataBits))
+
+  val out_data = Vec.fill(2) { Reg(Bits(width = tlDataBits)) }
+  val out_head = Reg(init = UInt(0, 1))
+  val out_count = Reg(init = UInt(0, 2))
+
+  val rdata = buffer(read_idx)
+  val shifted = Cat(rdata, prev) >> Cat(shift, UInt(0, 3))
+  val enq = s1_valid && s1_primed
+  val deq = io.out.valid && io.out.ready
+  // only read if the beat will have room in the queue
+  val pending = out_count + s1_valid - deq
+  val issue = !io.start.valid && read_beat < io.avail && pending < UInt(2)
+
+  io.out.valid := out_count != UInt(0)
+  io.out.bits := out_data(out_head)
+
+  when (enq) {
+    out_data((out_head + out_count)(0)) := shifted(tlDataBits - 1, 0)
+  }
+  when (deq) { out_head := out_head + UInt(1) }
+  out_count := out_count + enq - deq
+
+  s1_valid := issue
+  when (s1_valid) { prev := rdata }
+
+  when (issue) {
+    read_idx := read_beat(idxBits - 1, 0)
+    read_beat := read_beat + UInt(1)
+    s1_primed := primed
+    primed := Bool(true)
+  }
+
+  when (io.start.valid) {
+    shift := io.start.bits.shift
+    read_beat := io.start.bits.beat
+    primed := Bool(false)
+    s1_valid := Bool(false)
+    out_count := UInt(0)
+  }
 }
 
 class TileLinkDMATx extends DMAModule {
@@ -47,8 +180,18 @@ class TileLinkDMATx extends DMAModule {
     val dptw = new TLBPTWIO
     val net = new RemoteTileLinkIO
     val phys = Bool(INPUT)
+    // walks use the running process's page table, so they fail
+    // while the command's address space is not the running one
+    val walk_ok = Bool(INPUT)
+    val alloc = Bool(INPUT)
     val error = TxErrors.noerror.cloneType.asOutput
     val route_error = Bool(INPUT)
+    val max_retries = UInt(INPUT, 8)
+    val backoff = UInt(INPUT, 16)
+    val bytes_done = UInt(OUTPUT, paddrBits)
+    val crc = UInt(OUTPUT, 32)
+    val trace = Valid(new TraceEvent)
+    val fill_trace = Valid(new TraceEvent)
   }
 
   private val tlBlockOffset = tlBeatAddrBits + tlByteAddrBits
@@ -56,6 +199,10 @@ class TileLinkDMATx extends DMAModule {
   private val blockPgIdxBits = pgIdxBits - tlBlockOffset
   private val blocksPerPage = (1 << blockPgIdxBits)
   private val addrByteOff = tlMemoryOperandSizeBits + tlMemoryOpcodeBits + 1
+  private val nStagingBeats = nTxBufferBlocks * tlDataBeats
+
+  // one block in flight and the start of the next has to fit
+  require(nTxBufferBlocks >= 2)
 
   val vpn = Reg(UInt(width = vpnBits))
   val page_idx = Reg(UInt(width = pgIdxBits))
@@ -65,71 +212,126 @@ class TileLinkDMATx extends DMAModule {
   val bytes_left = Reg(UInt(width = paddrBits))
   val direction = Reg(Bool())
 
-  val beat_idx = Reg(UInt(width = tlBeatAddrBits))
-  val write_half = Reg(Bool())
-  val read_half = Reg(Bool())
+  // the block the fill side reads next (local for puts, remote for gets),
+  // the number of source blocks still to read, and the number of
+  // streamed blocks the remote receiver still owes us
+  val fill_block = Reg(UInt(width = tlBlockAddrBits))
+  val fill_left = Reg(UInt(width = paddrBits))
+  val stream_left = Reg(init = UInt(0, tlBlockAddrBits))
+
+  // a nacked block is retried after waiting backoff << retries cycles
+  val retries = Reg(UInt(width = 8))
+  val backoff_count = Reg(UInt(width = 32))
+  val can_retry = retries < io.max_retries
+  val backoff_shift = Mux(retries > UInt(15), UInt(15), retries(3, 0))
 
+  val total_bytes = Reg(UInt(width = paddrBits))
+  val bytes_done = Reg(init = UInt(0, paddrBits))
+
+  // checksum of the bytes sent (put) or written (get) so far,
+  // and its value before the block in flight, in case it is resent
+  val crc = Reg(init = CRC32C.init)
+  val block_crc = Reg(UInt(width = 32))
+
+  val beat_idx = Reg(UInt(width = tlBeatAddrBits))
+  val fill_beat = Reg(UInt(width = tlBeatAddrBits))
   val offset = Reg(UInt(width = tlBlockOffset))
-  val align = Reg(UInt(width = tlBlockOffset))
-  val align_dir = Reg(Bool())
+
+  // Source data goes through the staging buffer, from the fill side,
+  // which reads local memory (puts) or streams the remote range (gets),
+  // to the drain side, which sends it to the remote (puts) or writes it
+  // to local memory (gets), so reads run ahead of the destination.
+  // Staged beats are numbered from an empty block before the first source
+  // block, so that destination beat t (counted from the first destination
+  // block) is made from staged beats t + skip and t + skip + 1.
+  val staging = Module(new TxStagingBuffer(nTxBufferBlocks))
+  val shift = Reg(UInt(width = tlByteAddrBits))
+  // the next beat the fill side writes, and the first beat the
+  // destination block being drained needs. The ring holds what's between.
+  val filled = Reg(UInt(width = paddrBits))
+  val drained = Reg(UInt(width = paddrBits))
+  val fill_done = Reg(init = Bool(false))
+
+  // the staging buffer only puts out a beat once it has read the next
+  // one, even with no shift, so a block needs one beat past its end
+  val block_staged = fill_done ||
+    (drained + UInt(tlDataBeats + 1)) <= filled
+  val block_room = filled + UInt(tlDataBeats) <= drained + UInt(nStagingBeats)
+  val beat_room = filled < drained + UInt(nStagingBeats)
 
   val write_buffer = Mem(Bits(width = tlDataBits), tlDataBeats, seqRead = true)
-  val send_buffer = Vec.fill(2 * tlDataBeats) { Reg(Bits(width = tlDataBits)) }
-  val read_base = Cat(read_half, beat_idx)
-  val beat_data = Bits(width = tlDataBits)
-
-  beat_data := send_buffer(read_base)
-  when (align != UInt(0)) {
-    val align_beatoff = align(tlBlockOffset - 1, tlByteAddrBits)
-    val align_bitshift = Cat(align(tlByteAddrBits - 1, 0), UInt(0, 3))
-    // shifting to the right
-    when (align_dir) {
-      when (align_bitshift === UInt(0)) {
-        // take a beat from the left
-        beat_data := send_buffer(read_base + align_beatoff)
-      } .otherwise {
-        // take the upper bits of the base beat
-        // take the lower bits of the beat one above
-        val lower_beat = send_buffer(read_base + align_beatoff)
-        val upper_beat = send_buffer(read_base + align_beatoff + UInt(1))
-        val lower_shifted = lower_beat >> align_bitshift
-        val upper_shifted = upper_beat << (UInt(tlDataBits) - align_bitshift)
-        val full_mask = Fill(tlDataBits, Bool(true))
-        val lower_mask = full_mask >> align_bitshift
-        val upper_mask = ~lower_mask
-        beat_data := (lower_shifted & lower_mask) | (upper_shifted & upper_mask)
-      }
-    } .otherwise {
-      when (align_bitshift === UInt(0)) {
-        // take a beat from the right
-        beat_data := send_buffer(read_base - align_beatoff)
-      } .otherwise {
-        // take the lower bits of the base beat
-        // take the upper bits of the beat one below
-        val upper_beat = send_buffer(read_base - align_beatoff)
-        val lower_beat = send_buffer(read_base - align_beatoff - UInt(1))
-        val upper_shifted = upper_beat << align_bitshift
-        val lower_shifted = lower_beat >> (UInt(tlDataBits) - align_bitshift)
-        val full_mask = Fill(tlDataBits, Bool(true))
-        val upper_mask = full_mask << align_bitshift
-        val lower_mask = ~upper_mask
-        beat_data := (lower_shifted & lower_mask) | (upper_shifted & upper_mask)
-      }
-    }
+  val beat_data = staging.io.out.bits
+
+  // Transposed puts gather one column of the source tile into a row
+  // of the destination. Each element is read with a single-beat get,
+  // up to nElemXacts of them in flight, each tagged with its slot in
+  // elem_buf. Elements are taken out of the slots in order and placed
+  // at fill_pos, counted from the start of the first destination block.
+  // Each beat is staged once it is complete.
+  val transpose = Reg(init = Bool(false))
+  val elem_size = Reg(UInt(width = 2))
+  val elem_stride = Reg(UInt(width = paddrBits))
+  val elem_addr = Reg(UInt(width = paddrBits))
+  val elem_ppn = Reg(UInt(width = ppnBits))
+  val elem_vpn_valid = Reg(Bool())
+  val elem_beat = Reg(Bits(width = tlDataBits))
+  val fill_pos = Reg(UInt(width = paddrBits))
+  val fill_end = Reg(UInt(width = paddrBits))
+  // destination position of the next element to be requested
+  val elem_req_pos = Reg(UInt(width = paddrBits))
+  val elem_buf = Vec.fill(nElemXacts) { Reg(Bits(width = 64)) }
+  val elem_buf_valid = Vec.fill(nElemXacts) { Reg(init = Bool(false)) }
+  val elem_buf_offset = Vec.fill(nElemXacts) {
+    Reg(UInt(width = tlByteAddrBits))
   }
+  val elem_head = Reg(init = UInt(0, log2Up(nElemXacts)))
+  val elem_tail = Reg(init = UInt(0, log2Up(nElemXacts)))
+  val elem_inflight = Reg(init = UInt(0, log2Up(nElemXacts + 1)))
+
+  val accum = Reg(init = Bool(false))
+  val accum_op = Reg(UInt(width = 2))
+  val accum_type = Reg(UInt(width = 2))
+
+  val elem_vpn = elem_addr(paddrBits - 1, pgIdxBits)
+  val elem_phys = Mux(io.phys, elem_addr,
+    Cat(elem_ppn, elem_addr(pgIdxBits - 1, 0)))
+  val elem_bytes = UInt(1) << elem_size
+  val elem_mask = MuxLookup(elem_size, Fill(8, Bool(true)),
+    (UInt(1), Fill(16, Bool(true))) ::
+    (UInt(2), Fill(32, Bool(true))) ::
+    (UInt(3), Fill(64, Bool(true))) :: Nil)
+  val elem_grant_id = io.dmem.grant.bits.client_xact_id(
+    log2Up(nElemXacts) - 1, 0)
+  val elem_data = (io.dmem.grant.bits.data >>
+    Cat(elem_buf_offset(elem_grant_id), UInt(0, 3))) & elem_mask
+  val elem_slot = UInt(tlDataBeats) + fill_pos(paddrBits - 1, tlByteAddrBits)
+  val elem_req_slot = UInt(tlDataBeats) +
+    elem_req_pos(paddrBits - 1, tlByteAddrBits)
+  // everything before the requested element is staged at or before
+  // its beat, so there is room for all of them if there is for it
+  val elem_room = elem_req_slot < drained + UInt(nStagingBeats) &&
+    elem_inflight < UInt(nElemXacts)
 
   val net_grant = io.net.grant.bits.payload
 
   val first_block = Reg(Bool())
 
-  val (s_idle :: s_prepare_read :: s_ptw_req :: s_ptw_resp ::
-       s_dmem_get_acquire :: s_dmem_get_grant ::
-       s_net_put_acquire :: s_net_put_grant ::
-       s_net_get_acquire :: s_net_get_grant ::
-       s_dmem_put_acquire :: s_dmem_put_grant ::
-       s_copy_data :: Nil) = Enum(Bits(), 13)
+  // if you change the states, update tx_states in tests/dma-trace.c
+  val (s_idle :: s_prepare_write :: s_ptw_req :: s_ptw_resp ::
+       s_wait_data :: s_net_put_acquire :: s_net_put_grant ::
+       s_dmem_get_acquire :: s_dmem_get_grant :: s_copy_data ::
+       s_dmem_put_acquire :: s_dmem_put_grant :: s_backoff ::
+       Nil) = Enum(Bits(), 13)
   val state = Reg(init = s_idle)
 
+  // if you change the states, update tx_fill_states in tests/dma-trace.c
+  val (f_idle :: f_prepare_read :: f_ptw_req :: f_ptw_resp ::
+       f_dmem_get_acquire :: f_dmem_get_grant ::
+       f_net_get_acquire :: f_net_get_grant :: f_net_get_drain ::
+       f_backoff :: f_elem_req :: f_elem_acquire :: f_elem_grant ::
+       Nil) = Enum(Bits(), 13)
+  val fill_state = Reg(init = f_idle)
+
   val full_block = (offset === UInt(0) && bytes_left > UInt(tlBytesPerBlock))
   val wmask = Vec.tabulate(tlDataBytes) { i =>
     val byte_index = Cat(beat_idx, UInt(i, tlByteAddrBits))
@@ -138,140 +340,309 @@ class TileLinkDMATx extends DMAModule {
   val full_wmask = FillInterleaved(8, wmask)
 
   val error = Reg(init = TxErrors.noerror)
+  val failed = error != TxErrors.noerror
 
-  io.cmd.ready := (state === s_idle)
+  // element grants of a failed transposed put still have to come back
+  // before the next command can use their tags
+  val tx_idle = state === s_idle && fill_state === f_idle &&
+    elem_inflight === UInt(0)
+  io.cmd.ready := tx_idle
+  // once a segment fails the rest of its command is taken and dropped,
+  // so the error, bytes done and checksum describe where it stopped
+  val seg_dropped = !io.cmd.bits.first && failed
   io.error := error
+  io.bytes_done := bytes_done
+  io.crc := ~crc
+
+  val header = Reg(new RemoteHeader)
+  val xact_id = Reg(UInt(width = dmaXactIdBits))
+
+  val last_state = Reg(next = state, init = s_idle)
+  io.trace.valid := (state != last_state)
+  io.trace.bits.source := TraceSources.tx
+  io.trace.bits.code := state
+  io.trace.bits.info := error
+  io.trace.bits.xact_id := xact_id
+
+  val last_fill_state = Reg(next = fill_state, init = f_idle)
+  io.fill_trace.valid := (fill_state != last_fill_state)
+  io.fill_trace.bits.source := TraceSources.txFill
+  io.fill_trace.bits.code := fill_state
+  io.fill_trace.bits.info := error
+  io.fill_trace.bits.xact_id := xact_id
 
   val get_union = Cat(MT_Q, M_XRD, Bool(true))
-  val put_union = Cat(wmask, !full_block)
+  // an accumulating put always needs the existing block
+  val accum_mask = Vec.tabulate(tlDataBytes / 4) { i => wmask(4 * i) }.toBits
+  val put_union = Mux(accum,
+    Cat(accum_mask, accum_type, accum_op, Bool(true)),
+    Cat(wmask, !full_block))
 
   val dmem_type = Mux(state === s_dmem_put_acquire,
     Acquire.putBlockType, Acquire.getBlockType)
+  // the alloc bit tells the L2 whether to allocate the block we write
   val dmem_union = Mux(state === s_dmem_put_acquire,
-    Cat(Acquire.fullWriteMask, Bool(true)), get_union)
+    Cat(Acquire.fullWriteMask, io.alloc), get_union)
 
-  val header = Reg(new RemoteHeader)
-  val xact_id = Reg(UInt(width = dmaXactIdBits))
+  staging.io.write.valid := Bool(false)
+  staging.io.write.bits.beat := filled
+  staging.io.write.bits.data := io.dmem.grant.bits.data
+  staging.io.avail := Mux(fill_done, ~UInt(0, paddrBits), filled)
+  staging.io.start.valid := Bool(false)
+  staging.io.start.bits.beat := drained
+  staging.io.start.bits.shift := shift
+  staging.io.out.ready := Bool(false)
 
-  io.dmem.grant.ready := (state === s_dmem_get_grant ||
+  // the fill side only uses memory for puts, and the drain side for gets
+  io.dmem.grant.ready := (fill_state === f_dmem_get_grant ||
+                          elem_inflight != UInt(0) ||
+                          state === s_dmem_get_grant ||
                           state === s_dmem_put_grant)
-  io.dmem.acquire.valid := (state === s_dmem_get_acquire ||
-                            state === s_dmem_put_acquire)
+  io.dmem.acquire.valid := (fill_state === f_dmem_get_acquire &&
+                            block_room && !failed) ||
+                           fill_state === f_elem_acquire ||
+                           state === s_dmem_get_acquire ||
+                           state === s_dmem_put_acquire
   io.dmem.acquire.bits := Acquire(
     is_builtin_type = Bool(true),
     a_type = dmem_type,
     client_xact_id = xact_id,
-    addr_block = local_block,
-    addr_beat = beat_idx,
+    addr_block = Mux(direction, fill_block, local_block),
+    addr_beat = Mux(direction, UInt(0), beat_idx),
     data = write_buffer(beat_idx),
     union = dmem_union)
+  when (fill_state === f_elem_acquire) {
+    io.dmem.acquire.bits := Get(
+      client_xact_id = elem_head,
+      addr_block = elem_phys(paddrBits - 1, tlBlockOffset),
+      addr_beat = elem_phys(tlBlockOffset - 1, tlByteAddrBits))
+  }
   debug(io.dmem.grant.bits.g_type)
 
-  val net_type = MuxLookup(state, Acquire.getBlockType,
-    (s_net_put_acquire, Acquire.putBlockType) ::
-    (s_net_get_acquire, Acquire.getBlockType) :: Nil)
+  // likewise, the drain side sends puts and the fill side sends gets,
+  // asking for the rest of the remote range in one request
+  val net_type = Mux(direction,
+    Mux(accum, RemoteAcquire.putAccumType, Acquire.putBlockType),
+    RemoteAcquire.getStreamType)
+  val net_data = Mux(direction, beat_data, fill_left)
 
   // we use the alloc bit to hint to the receiver that we are not sending
   // a full block, so the existing block should be read in before receiving
-  val net_union = MuxLookup(state, get_union,
-    (s_net_put_acquire, put_union) ::
-    (s_net_get_acquire, get_union) :: Nil)
+  val net_union = Mux(direction, put_union, get_union)
 
-  io.net.grant.ready := direction || (state === s_net_get_grant)
-  io.net.acquire.valid := (state === s_net_put_acquire) ||
-                          (state === s_net_get_acquire)
+  io.net.grant.ready := direction ||
+                        (fill_state === f_net_get_grant &&
+                         beat_room && !failed) ||
+                        (fill_state === f_net_get_drain)
+  io.net.acquire.valid := (state === s_net_put_acquire &&
+                           staging.io.out.valid) ||
+                          (fill_state === f_net_get_acquire && !failed)
+  // the segment's id goes along so that the receiver's trace records
+  // can be matched up with the sender's
   io.net.acquire.bits.payload := Acquire(
     is_builtin_type = Bool(true),
     a_type = net_type,
-    client_xact_id = UInt(0),
-    addr_block = remote_block,
-    addr_beat = beat_idx,
-    data = beat_data,
+    client_xact_id = xact_id,
+    addr_block = Mux(direction, remote_block, fill_block),
+    addr_beat = Mux(direction, beat_idx, UInt(0)),
+    data = net_data,
     union = net_union)
   io.net.acquire.bits.header := header
   io.net.acquire.bits.last := (bytes_left <= UInt(tlBytesPerBlock))
 
-  io.dptw.req.valid := (state === s_ptw_req)
+  io.dptw.req.valid := ((state === s_ptw_req) ||
+                        (fill_state === f_ptw_req && !failed)) && io.walk_ok
   io.dptw.req.bits.addr := vpn
   io.dptw.req.bits.prv := Bits(0)
-  io.dptw.req.bits.store := Bool(false)
-  io.dptw.req.bits.fetch := Bool(true)
+  // the only local writes are the destination of gets
+  io.dptw.req.bits.store := !direction
+  io.dptw.req.bits.fetch := direction
+
+  // set when the destination block has been acked (put) or written (get)
+  val block_done = Bool()
+  block_done := Bool(false)
 
   switch (state) {
     is (s_idle) {
-      when (io.cmd.valid) {
+      when (io.cmd.valid && tx_idle && !seg_dropped) {
         val cmd_dir = io.cmd.bits.direction
         val src_start = io.cmd.bits.src_start
         val dst_start = io.cmd.bits.dst_start
         val local_start = Mux(cmd_dir, src_start, dst_start)
         val remote_start = Mux(cmd_dir, dst_start, src_start)
-
-        when (io.phys) {
-          beat_idx := UInt(0)
-          local_block := local_start(paddrBits - 1, tlBlockOffset)
-          state := Mux(cmd_dir, s_dmem_get_acquire, s_net_get_acquire)
-        } .otherwise {
-          vpn := local_start(paddrBits - 1, pgIdxBits)
-          page_idx := local_start(pgIdxBits - 1, 0)
-          state := s_ptw_req
-        }
-        remote_block := remote_start(paddrBits - 1, tlBlockOffset)
+        val src_end = src_start + io.cmd.bits.nbytes +
+                      UInt(tlBytesPerBlock - 1)
 
         val dst_off = dst_start(tlBlockOffset - 1, 0)
         val src_off = src_start(tlBlockOffset - 1, 0)
 
-        when (dst_off < src_off) {
-          align := src_off - dst_off
-          align_dir := Bool(true)
+        // destination byte i comes from source byte i + src_off - dst_off;
+        // transposed elements are staged right where they belong
+        val cmd_align = Mux(io.cmd.bits.transpose, UInt(tlBytesPerBlock),
+          UInt(tlBytesPerBlock) + src_off - dst_off)
+        val cmd_skip = cmd_align(tlBlockOffset, tlByteAddrBits)
+        val cmd_shift = cmd_align(tlByteAddrBits - 1, 0)
+
+        vpn := local_start(paddrBits - 1, pgIdxBits)
+        page_idx := local_start(pgIdxBits - 1, 0)
+        local_block := local_start(paddrBits - 1, tlBlockOffset)
+        remote_block := remote_start(paddrBits - 1, tlBlockOffset)
+        fill_block := Mux(cmd_dir, local_start, remote_start)(
+          paddrBits - 1, tlBlockOffset)
+        fill_left := src_end(paddrBits - 1, tlBlockOffset) -
+                     src_start(paddrBits - 1, tlBlockOffset)
+
+        shift := cmd_shift
+        drained := cmd_skip
+        filled := Mux(io.cmd.bits.transpose,
+          UInt(tlDataBeats) + dst_off(tlBlockOffset - 1, tlByteAddrBits),
+          UInt(tlDataBeats))
+        fill_done := Bool(false)
+        staging.io.start.valid := Bool(true)
+        staging.io.start.bits.beat := cmd_skip
+        staging.io.start.bits.shift := cmd_shift
+
+        when (io.cmd.bits.transpose) {
+          fill_state := f_elem_req
+        } .elsewhen (!cmd_dir) {
+          fill_state := f_net_get_acquire
+        } .elsewhen (io.phys) {
+          fill_state := f_dmem_get_acquire
         } .otherwise {
-          align := dst_off - src_off
-          align_dir := Bool(false)
+          fill_state := f_ptw_req
+        }
+
+        when (cmd_dir) {
+          state := s_wait_data
+        } .elsewhen (io.phys) {
+          state := s_prepare_write
+        } .otherwise {
+          state := s_ptw_req
         }
+
         // need to tack on the dst offset because
         // we will subtract #bytes in a block after transmission
         bytes_left  := io.cmd.bits.nbytes + dst_off
         offset      := dst_off
         header      := io.cmd.bits.header
         xact_id     := io.cmd.bits.xact_id
-        write_half  := Bool(false)
-        read_half   := Bool(false)
+        beat_idx    := UInt(0)
+        fill_beat   := UInt(0)
         first_block := Bool(true)
         direction   := cmd_dir
         error       := TxErrors.noerror
+        retries     := UInt(0)
+        // the count of bytes done also covers all segments of a command
+        val start_bytes = Mux(io.cmd.bits.first, UInt(0), bytes_done)
+        total_bytes := start_bytes + io.cmd.bits.nbytes
+        bytes_done  := start_bytes
+
+        // the checksum covers all segments of a command
+        val start_crc = Mux(io.cmd.bits.first, CRC32C.init, crc)
+        crc         := start_crc
+        block_crc   := start_crc
+
+        transpose      := io.cmd.bits.transpose
+        elem_size      := io.cmd.bits.elem_size
+        elem_stride    := io.cmd.bits.elem_stride
+        accum          := io.cmd.bits.accum
+        accum_op       := io.cmd.bits.accum_op
+        accum_type     := io.cmd.bits.accum_type
+        elem_addr      := src_start
+        elem_vpn_valid := Bool(false)
+        fill_pos       := dst_off
+        fill_end       := io.cmd.bits.nbytes + dst_off
+        elem_req_pos   := dst_off
       }
     }
+    is (s_prepare_write) {
+      val dst_page_idx = local_block(blockPgIdxBits - 1, 0)
+      when (!io.phys && !first_block && dst_page_idx === UInt(0)) {
+        vpn := vpn + UInt(1)
+        page_idx := UInt(0)
+        state := s_ptw_req
+      } .elsewhen (full_block) {
+        state := s_wait_data
+      } .otherwise {
+        state := s_dmem_get_acquire
+      }
+      beat_idx := UInt(0)
+    }
     is (s_ptw_req) {
-      when (io.dptw.req.ready) {
+      when (!io.walk_ok) {
+        error := TxErrors.pageFault
+        state := s_idle
+      } .elsewhen (io.dptw.req.ready) {
         state := s_ptw_resp
       }
     }
     is (s_ptw_resp) {
       when (io.dptw.resp.valid) {
-        when (io.dptw.resp.bits.error) {
+        when (io.dptw.resp.bits.error || !io.walk_ok) {
           error := TxErrors.pageFault
           state := s_idle
         } .otherwise {
           val fullPhysAddr = Cat(io.dptw.resp.bits.pte.ppn, page_idx)
           local_block := fullPhysAddr(paddrBits - 1, tlBlockOffset)
           beat_idx := UInt(0)
-          state := Mux(direction, s_dmem_get_acquire, s_net_get_acquire)
+          state := Mux(full_block, s_wait_data, s_dmem_get_acquire)
         }
       }
     }
-    is (s_prepare_read) {
-      val src_page_idx = local_block(blockPgIdxBits - 1, 0)
-      when (align >= bytes_left) {
-        // if there are enough bytes already in the buffer (the read shift)
-        // we can just send/write the last block
-        state := Mux(direction, s_net_put_acquire, s_dmem_get_acquire)
-      } .elsewhen (!io.phys && src_page_idx === UInt(0)) {
-        vpn := vpn + UInt(1)
-        page_idx := UInt(0)
-        state := s_ptw_req
-      } .otherwise {
-        state := Mux(direction, s_dmem_get_acquire, s_net_get_acquire)
+    // a block is only started once all of its source data is staged,
+    // so a failure on the fill side never leaves it half sent
+    is (s_wait_data) {
+      when (failed) {
+        state := s_idle
+      } .elsewhen (block_staged) {
+        beat_idx := UInt(0)
+        state := Mux(direction, s_net_put_acquire, s_copy_data)
       }
-      beat_idx := UInt(0)
+    }
+    is (s_net_put_acquire) {
+      when (io.route_error) {
+        error := TxErrors.noRoute
+        state := s_idle
+      } .elsewhen (failed && beat_idx === UInt(0)) {
+        // nothing of this block has gone out yet, so the receiver
+        // is not left waiting for the rest of it
+        state := s_idle
+      } .elsewhen (io.net.acquire.ready && staging.io.out.valid) {
+        staging.io.out.ready := Bool(true)
+        when (beat_idx === UInt(tlDataBeats - 1)) {
+          state := s_net_put_grant
+        }
+        crc := CRC32C(crc, beat_data, wmask)
+        beat_idx := beat_idx + UInt(1)
+      }
+    }
+    is (s_net_put_grant) {
+      when (io.net.grant.valid) {
+        when (net_grant.g_type === Grant.nackType) {
+          // the receiver did not take this block
+          crc := block_crc
+          // the block is still staged, so we can resend it
+          when (can_retry) {
+            retries := retries + UInt(1)
+            backoff_count := io.backoff << backoff_shift
+            beat_idx := UInt(0)
+            staging.io.start.valid := Bool(true)
+            state := s_backoff
+          } .otherwise {
+            error := TxErrors.nack
+            state := s_idle
+          }
+        } .otherwise {
+          retries := UInt(0)
+          block_done := Bool(true)
+        }
+      }
+    }
+    is (s_backoff) {
+      when (backoff_count === UInt(0)) {
+        state := s_net_put_acquire
+      }
+      backoff_count := backoff_count - UInt(1)
     }
     is (s_dmem_get_acquire) {
       when (io.dmem.acquire.ready) {
@@ -280,43 +651,26 @@ class TileLinkDMATx extends DMAModule {
     }
     is (s_dmem_get_grant) {
       when (io.dmem.grant.valid) {
-        when (direction) {
-          val index = Cat(write_half, beat_idx)
-          send_buffer(index) := io.dmem.grant.bits.data
-          when (beat_idx === UInt(tlDataBeats - 1)) {
-            val bytes_in_buffer = UInt(tlBytesPerBlock) - align
-            val needs_more_data = align_dir && first_block &&
-                                  bytes_in_buffer < bytes_left
-            when (needs_more_data) {
-              local_block := local_block + UInt(1)
-              state := s_prepare_read
-            } .otherwise {
-              beat_idx := UInt(0)
-              state := s_net_put_acquire
-            }
-            write_half := !write_half
-            first_block := Bool(false)
-          }
-          beat_idx := beat_idx + UInt(1)
-        } .otherwise {
-          write_buffer(beat_idx) := io.dmem.grant.bits.data
-          when (beat_idx === UInt(tlDataBeats - 1)) {
-            beat_idx := offset(tlBlockOffset - 1, tlByteAddrBits)
-            state := s_copy_data
-          } .otherwise {
-            beat_idx := beat_idx + UInt(1)
-          }
+        write_buffer(beat_idx) := io.dmem.grant.bits.data
+        when (beat_idx === UInt(tlDataBeats - 1)) {
+          state := s_wait_data
         }
+        beat_idx := beat_idx + UInt(1)
       }
     }
     is (s_copy_data) {
-      write_buffer.write(beat_idx, beat_data, full_wmask)
-      when (beat_idx === UInt(tlDataBeats - 1)) {
-        read_half := !read_half
-        offset := UInt(0)
-        state := s_dmem_put_acquire
+      staging.io.out.ready := Bool(true)
+      // nothing has been written yet, so a failed get can stop here
+      when (failed && !staging.io.out.valid) {
+        state := s_idle
+      } .elsewhen (staging.io.out.valid) {
+        write_buffer.write(beat_idx, beat_data, full_wmask)
+        crc := CRC32C(crc, beat_data, wmask)
+        when (beat_idx === UInt(tlDataBeats - 1)) {
+          state := s_dmem_put_acquire
+        }
+        beat_idx := beat_idx + UInt(1)
       }
-      beat_idx := beat_idx + UInt(1)
     }
     is (s_dmem_put_acquire) {
       when (io.dmem.acquire.ready) {
@@ -328,81 +682,227 @@ class TileLinkDMATx extends DMAModule {
     }
     is (s_dmem_put_grant) {
       when (io.dmem.grant.valid) {
-        when (bytes_left <= UInt(tlBytesPerBlock)) {
-          bytes_left := UInt(0)
-          state := s_idle
+        block_done := Bool(true)
+      }
+    }
+  }
+
+  when (block_done) {
+    when (bytes_left <= UInt(tlBytesPerBlock)) {
+      bytes_left := UInt(0)
+      bytes_done := total_bytes
+      state := s_idle
+    } .otherwise {
+      remote_block := remote_block + UInt(1)
+      local_block := local_block + UInt(1)
+      bytes_left := bytes_left - UInt(tlBytesPerBlock)
+      bytes_done := bytes_done + UInt(tlBytesPerBlock) - offset
+      offset := UInt(0)
+      block_crc := crc
+      first_block := Bool(false)
+      // the staged beats before the next block can be overwritten
+      drained := drained + UInt(tlDataBeats)
+      beat_idx := UInt(0)
+      state := Mux(direction, s_wait_data, s_prepare_write)
+    }
+  }
+
+  // the fill side stops at a block boundary once the command has failed
+  switch (fill_state) {
+    is (f_prepare_read) {
+      val src_page_idx = fill_block(blockPgIdxBits - 1, 0)
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (fill_left === UInt(0)) {
+        fill_done := Bool(true)
+        fill_state := f_idle
+      } .elsewhen (!io.phys && src_page_idx === UInt(0)) {
+        vpn := vpn + UInt(1)
+        page_idx := UInt(0)
+        fill_state := f_ptw_req
+      } .otherwise {
+        fill_state := f_dmem_get_acquire
+      }
+    }
+    is (f_ptw_req) {
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (!io.walk_ok) {
+        error := TxErrors.pageFault
+        fill_state := f_idle
+      } .elsewhen (io.dptw.req.ready) {
+        fill_state := f_ptw_resp
+      }
+    }
+    is (f_ptw_resp) {
+      when (io.dptw.resp.valid) {
+        when (io.dptw.resp.bits.error || !io.walk_ok) {
+          error := TxErrors.pageFault
+          fill_state := f_idle
+        } .elsewhen (transpose) {
+          elem_ppn := io.dptw.resp.bits.pte.ppn
+          elem_vpn_valid := Bool(true)
+          fill_state := f_elem_acquire
         } .otherwise {
-          remote_block := remote_block + UInt(1)
-          local_block := local_block + UInt(1)
-          bytes_left := bytes_left - UInt(tlBytesPerBlock)
-          state := s_prepare_read
+          val fullPhysAddr = Cat(io.dptw.resp.bits.pte.ppn, page_idx)
+          fill_block := fullPhysAddr(paddrBits - 1, tlBlockOffset)
+          fill_state := f_dmem_get_acquire
         }
       }
     }
-    is (s_net_get_acquire) {
-      when (io.net.acquire.ready) {
-        state := s_net_get_grant
+    is (f_dmem_get_acquire) {
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (io.dmem.acquire.ready && block_room) {
+        fill_beat := UInt(0)
+        fill_state := f_dmem_get_grant
       }
     }
-    is (s_net_get_grant) {
-      when (io.net.grant.valid) {
-        when (net_grant.g_type === Grant.nackType) {
-          error := TxErrors.nack
-          state := s_idle
-        } .otherwise {
-          val index = Cat(write_half, beat_idx)
-          send_buffer(index) := net_grant.data
-          when (beat_idx === UInt(tlDataBeats - 1)) {
-            val bytes_in_buffer = UInt(tlBytesPerBlock) - align
-            val needs_more_data = align_dir && first_block &&
-                                  bytes_in_buffer < bytes_left
-            when (needs_more_data) {
-              remote_block := remote_block + UInt(1)
-              state := s_prepare_read
-            } .elsewhen (full_block) {
-              beat_idx := offset(tlBlockOffset - 1, tlByteAddrBits)
-              state := s_copy_data
-            } .otherwise {
-              beat_idx := UInt(0)
-              state := s_dmem_get_acquire
-            }
-            write_half := !write_half
-            first_block := Bool(false)
-          } .otherwise {
-            beat_idx := beat_idx + UInt(1)
-          }
+    is (f_dmem_get_grant) {
+      when (io.dmem.grant.valid) {
+        staging.io.write.valid := Bool(true)
+        filled := filled + UInt(1)
+        when (fill_beat === UInt(tlDataBeats - 1)) {
+          fill_block := fill_block + UInt(1)
+          fill_left := fill_left - UInt(1)
+          fill_state := f_prepare_read
         }
+        fill_beat := fill_beat + UInt(1)
       }
     }
-    is (s_net_put_acquire) {
-      when (io.route_error) {
+    is (f_net_get_acquire) {
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (io.route_error) {
         error := TxErrors.noRoute
-        state := s_idle
+        fill_state := f_idle
       } .elsewhen (io.net.acquire.ready) {
-        when (beat_idx === UInt(tlDataBeats - 1)) {
-          state := s_net_put_grant
+        stream_left := fill_left
+        fill_beat := UInt(0)
+        fill_state := f_net_get_grant
+      }
+    }
+    is (f_net_get_grant) {
+      when (failed) {
+        // the remote side may still be streaming blocks to us
+        fill_state := Mux(stream_left === UInt(0), f_idle, f_net_get_drain)
+      } .elsewhen (io.net.grant.valid && beat_room) {
+        when (net_grant.g_type === Grant.nackType) {
+          // the receiver stops streaming after a nack
+          stream_left := UInt(0)
+          filled := filled - fill_beat
+          when (can_retry) {
+            retries := retries + UInt(1)
+            backoff_count := io.backoff << backoff_shift
+            fill_state := f_backoff
+          } .otherwise {
+            error := TxErrors.nack
+            fill_state := f_idle
+          }
+        } .otherwise {
+          staging.io.write.valid := Bool(true)
+          staging.io.write.bits.data := net_grant.data
+          filled := filled + UInt(1)
+          when (fill_beat === UInt(tlDataBeats - 1)) {
+            stream_left := stream_left - UInt(1)
+            fill_block := fill_block + UInt(1)
+            fill_left := fill_left - UInt(1)
+            retries := UInt(0)
+            when (fill_left === UInt(1)) {
+              fill_done := Bool(true)
+              fill_state := f_idle
+            }
+          }
+          fill_beat := fill_beat + UInt(1)
         }
-        beat_idx := beat_idx + UInt(1)
       }
     }
-    is (s_net_put_grant) {
+    // throw away the blocks we requested but did not end up needing
+    is (f_net_get_drain) {
       when (io.net.grant.valid) {
         when (net_grant.g_type === Grant.nackType) {
-          error := TxErrors.nack
-          state := s_idle
-        } .elsewhen (bytes_left <= UInt(tlBytesPerBlock)) {
-          bytes_left := UInt(0)
-          state := s_idle
+          stream_left := UInt(0)
+          fill_state := f_idle
+        } .elsewhen (fill_beat === UInt(tlDataBeats - 1)) {
+          when (stream_left === UInt(1)) {
+            fill_state := f_idle
+          }
+          stream_left := stream_left - UInt(1)
+        }
+        fill_beat := fill_beat + UInt(1)
+      }
+    }
+    is (f_backoff) {
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (backoff_count === UInt(0)) {
+        fill_state := f_net_get_acquire
+      }
+      backoff_count := backoff_count - UInt(1)
+    }
+    is (f_elem_req) {
+      when (failed) {
+        fill_state := f_idle
+      } .elsewhen (elem_room) {
+        when (io.phys || (elem_vpn_valid && vpn === elem_vpn)) {
+          fill_state := f_elem_acquire
         } .otherwise {
-          remote_block := remote_block + UInt(1)
-          local_block := local_block + UInt(1)
-          read_half := !read_half
-          offset := UInt(0)
-          bytes_left := bytes_left - UInt(tlBytesPerBlock)
-          state := s_prepare_read
+          vpn := elem_vpn
+          fill_state := f_ptw_req
         }
       }
     }
+    is (f_elem_acquire) {
+      when (io.dmem.acquire.ready) {
+        val next_req_pos = elem_req_pos + elem_bytes
+        elem_buf_offset(elem_head) := elem_phys(tlByteAddrBits - 1, 0)
+        elem_head := elem_head + UInt(1)
+        elem_addr := elem_addr + elem_stride
+        elem_req_pos := next_req_pos
+        fill_state := Mux(next_req_pos >= fill_end, f_elem_grant, f_elem_req)
+      }
+    }
+    is (f_elem_grant) {
+      // every element has been requested, wait for the rest to arrive
+      when (failed || fill_done) {
+        fill_state := f_idle
+      }
+    }
+  }
+
+  val elem_issue = fill_state === f_elem_acquire && io.dmem.acquire.ready
+  val elem_take = elem_buf_valid(elem_tail)
+  elem_inflight := elem_inflight + elem_issue - elem_take
+
+  when (io.dmem.grant.fire() && elem_inflight != UInt(0)) {
+    elem_buf(elem_grant_id) := elem_data
+    elem_buf_valid(elem_grant_id) := Bool(true)
+  }
+
+  when (elem_take) {
+    val dst_shift = Cat(fill_pos(tlByteAddrBits - 1, 0), UInt(0, 3))
+    val new_beat = (elem_beat & ~(elem_mask << dst_shift)) |
+                   (elem_buf(elem_tail) << dst_shift)
+    val next_pos = fill_pos + elem_bytes
+    val beat_end = next_pos(paddrBits - 1, tlByteAddrBits) !=
+                   fill_pos(paddrBits - 1, tlByteAddrBits)
+    val last_elem = next_pos >= fill_end
+
+    elem_buf_valid(elem_tail) := Bool(false)
+    elem_tail := elem_tail + UInt(1)
+    elem_beat := new_beat
+    fill_pos := next_pos
+
+    // the elements of a failed put are only collected to free their tags
+    when ((beat_end || last_elem) && !failed) {
+      staging.io.write.valid := Bool(true)
+      staging.io.write.bits.beat := elem_slot
+      staging.io.write.bits.data := new_beat
+      filled := elem_slot + UInt(1)
+    }
+    when (last_elem && !failed) {
+      fill_done := Bool(true)
+    }
   }
 }
 
@@ -411,13 +911,22 @@ class TileLinkDMARx extends DMAModule {
     val net = new RemoteTileLinkIO().flip
     val dmem = new ClientUncachedTileLinkIO
     val dptw = new TLBPTWIO
-    val phys = Bool(INPUT)
-    val local_addr = new RemoteAddress().asInput
+    val contexts = Vec.fill(nContexts) { new RxContext }.asInput
     val remote_addr = new RemoteAddress().asOutput
     val route_error = Bool(INPUT)
+    val crc = UInt(OUTPUT, 32)
+    val crc_clear = Bool(INPUT)
+    val trace = Valid(new TraceEvent)
+    // when check_windows is set, requests that don't fall entirely
+    // inside a registered window are nacked without touching memory
+    val windows = Vec.fill(nRxWindows) { new RxWindow }.asInput
+    val check_windows = Bool(INPUT)
+    val rejects = UInt(OUTPUT, 32)
+    val flush = Bool(INPUT)
   }
 
   private val tlBlockOffset = tlBeatAddrBits + tlByteAddrBits
+  private val tlBytesPerBlock = tlDataBeats * tlDataBytes
   private val blockPgIdxBits = pgIdxBits - tlBlockOffset
 
   val addr_block = Reg(init = UInt(0, tlBlockAddrBits))
@@ -427,79 +936,232 @@ class TileLinkDMARx extends DMAModule {
   val vpn = Reg(UInt(width = vpnBits))
   val net_xact_id = Reg(UInt(0, dmaXactIdBits))
   val net_acquire = io.net.acquire.bits.payload
+  val vpn_valid = Reg(init = Bool(false))
+  // the cached page was walked with store permission, so puts may use it
+  val vpn_store = Reg(Bool())
   val direction = Reg(Bool())
+  val stream = Reg(Bool())
   val nack = Reg(Bool())
+  val phys = Reg(Bool())
+  val alloc = Reg(Bool())
+  val accum = Reg(Bool())
+  val accum_op = Reg(UInt(width = 2))
+  val accum_type = Reg(UInt(width = 2))
+
+  val net_vpn = net_acquire.addr_block(tlBlockAddrBits - 1, blockPgIdxBits)
+  val net_page_idx = net_acquire.addr_block(blockPgIdxBits - 1, 0)
+  val net_accum = (net_acquire.a_type === RemoteAcquire.putAccumType)
+  val net_write = (net_acquire.a_type === Acquire.putBlockType) || net_accum
+  // the element mask of an accumulating put, widened to bytes
+  val net_accum_mask = FillInterleaved(4,
+    net_acquire.union(tlDataBytes / 4 + 4, 5))
+  val net_wmask = Mux(accum, net_accum_mask, net_acquire.wmask())
+  val net_data = Mux(accum,
+    Accumulate(accum_op, accum_type, buffer(beat_idx), net_acquire.data),
+    net_acquire.data)
+  val net_stream = (net_acquire.a_type === RemoteAcquire.getStreamType)
+  val net_nblocks = Mux(net_stream,
+    net_acquire.data(tlBlockAddrBits - 1, 0), UInt(1))
+
+  // the blocks a request touches must all lie inside one window
+  val net_first = Cat(UInt(0, 1), net_acquire.addr_block)
+  val net_end = net_first + net_nblocks
+  val window_hits = io.windows.map { w =>
+    val w_end = Cat(UInt(0, 1), w.base) + w.size
+    val w_first = (Cat(UInt(0, 1), w.base) +
+                   UInt(tlBytesPerBlock - 1)) >> UInt(tlBlockOffset)
+    val w_last = w_end >> UInt(tlBlockOffset)
+    Mux(net_write, w.write, w.read) &&
+      w.port === io.net.acquire.bits.header.dst.port &&
+      (w.key === UInt(0) || w.key === io.net.acquire.bits.header.src.port) &&
+      net_first >= w_first && net_end <= w_last
+  }
+  val in_window = window_hits.reduce(_ || _)
+  val rejects = Reg(init = UInt(0, 32))
+  io.rejects := rejects
+
+  // requests go to the active context unless another one is bound to
+  // their port, so a port no context is bound to reaches the active one
+  val ctx_hits = io.contexts.map(c =>
+    c.valid && c.addr.port === io.net.acquire.bits.header.dst.port)
+  val ctx_active_oh = Vec(io.contexts.map(_.active)).toBits
+  val ctx_active_hit = Mux1H(ctx_active_oh, ctx_hits)
+  val ctx_sel = Mux(ctx_active_hit || !ctx_hits.reduce(_ || _),
+    ctx_active_oh, Vec(PriorityEncoderOH(ctx_hits)).toBits)
+  val ctx_phys = Mux1H(ctx_sel, io.contexts.map(_.phys))
+  val ctx_alloc = Mux1H(ctx_sel, io.contexts.map(_.alloc))
+  val ctx_active = Mux1H(ctx_sel, io.contexts.map(_.active))
+  // only the running process's page table can be walked, so a virtual
+  // request to any other context is nacked until it runs again
+  val ctx_ok = ctx_active || ctx_phys
 
+  // translations of pages inside registered windows, so that
+  // requests to fixed receive buffers rarely need a page walk.
+  // they go away when the core's TLB is flushed (sfence.vm), and on
+  // TLB_FLUSH, PHYS, CONTEXT_ASID or window writes
+  val tlb_valid = Vec.fill(nRxWindows) { Reg(init = Bool(false)) }
+  val tlb_vpn = Vec.fill(nRxWindows) { Reg(UInt(width = vpnBits)) }
+  val tlb_ppn = Vec.fill(nRxWindows) { Reg(UInt(width = ppnBits)) }
+  val tlb_store = Vec.fill(nRxWindows) { Reg(Bool()) }
+  val tlb_repl = Reg(init = UInt(0, log2Up(nRxWindows)))
+  // a put can't use a translation that was only walked for reading
+  val tlb_hits = (0 until nRxWindows).map(
+    i => tlb_valid(i) && tlb_vpn(i) === net_vpn &&
+         (tlb_store(i) || !net_write))
+  val tlb_hit = io.check_windows && tlb_hits.reduce(_ || _)
+  val tlb_hit_ppn = Mux1H(tlb_hits, tlb_ppn)
+  val tlb_hit_store = Mux1H(tlb_hits, tlb_store)
+  val walk_in_window = Reg(Bool())
+  // a flush came in while the walk was in flight, so its result
+  // serves the request but must not be cached
+  val walk_stale = Reg(init = Bool(false))
+
+  // if you change the states, update rx_states in tests/dma-trace.c
   val (s_idle :: s_recv :: s_ack :: s_prepare_recv ::
        s_get_acquire :: s_get_grant :: s_put_acquire :: s_put_grant ::
-       s_ptw_req :: s_ptw_resp :: s_discard :: Nil) = Enum(Bits(), 11)
+       s_ptw_req :: s_ptw_resp :: s_discard ::
+       s_stream_ack :: Nil) = Enum(Bits(), 12)
   val state = Reg(init = s_idle)
 
+  // Streaming gets are served from a two-block buffer.
+  // The fill engine reads the next block from memory into one half
+  // while the other half is being sent out over the network.
+  val stream_buffer = Mem(Bits(width = tlDataBits), 2 * tlDataBeats,
+                          seqRead = true)
+  val half_full = Vec.fill(2) { Reg(init = Bool(false)) }
+  val fill_block = Reg(UInt(width = tlBlockAddrBits))
+  val fill_beat = Reg(UInt(width = tlBeatAddrBits))
+  val fill_half = Reg(Bool())
+  val fill_left = Reg(init = UInt(0, tlBlockAddrBits))
+  val fill_error = Reg(init = Bool(false))
+  // set when the stream is given up, so that a block the fill engine
+  // is still reading cannot restart it
+  val fill_abort = Reg(init = Bool(false))
+  val drain_half = Reg(Bool())
+  val drain_left = Reg(UInt(width = tlBlockAddrBits))
+
+  val (f_idle :: f_acquire :: f_grant ::
+       f_ptw_req :: f_ptw_resp :: Nil) = Enum(Bits(), 5)
+  val fill_state = Reg(init = f_idle)
+  val filling = (fill_state === f_acquire)
+  val fill_stopped = (fill_state === f_idle) && (fill_left === UInt(0))
+
+  // once the fill engine has given up, whatever it has not filled
+  // will never arrive, so we nack instead
+  val stream_nack = !half_full(drain_half) && fill_error
+
   val remote_addr = Reg(new RemoteAddress)
   val local_addr = Reg(new RemoteAddress)
 
+  // checksum of all bytes received by puts since it was last cleared
+  val crc = Reg(init = CRC32C.init)
+
   io.remote_addr := remote_addr
+  io.crc := ~crc
+
+  val last_state = Reg(next = state, init = s_idle)
+  io.trace.valid := (state != last_state)
+  io.trace.bits.source := TraceSources.rx
+  io.trace.bits.code := state
+  io.trace.bits.info := remote_addr.port
+  io.trace.bits.xact_id := net_xact_id
 
   val net_type = Mux(nack, Grant.nackType,
                  Mux(direction, Grant.putAckType, Grant.getDataBlockType))
 
+  val stream_type = Mux(stream_nack, Grant.nackType, Grant.getDataBlockType)
+
   io.net.acquire.ready := (state === s_recv) || (state === s_discard)
-  io.net.grant.valid := (state === s_ack)
+  io.net.grant.valid := (state === s_ack) ||
+    (state === s_stream_ack && (half_full(drain_half) || fill_error))
   io.net.grant.bits.payload := Grant(
     is_builtin_type = Bool(true),
-    g_type = net_type,
+    g_type = Mux(state === s_stream_ack, stream_type, net_type),
     client_xact_id = net_xact_id,
     manager_xact_id = UInt(0),
     addr_beat = beat_idx,
-    data = buffer(beat_idx))
+    data = Mux(state === s_stream_ack,
+      stream_buffer(Cat(drain_half, beat_idx)), buffer(beat_idx)))
   io.net.grant.bits.header.src := local_addr
   io.net.grant.bits.header.dst := remote_addr
 
-  val dmem_type = Mux(state === s_get_acquire,
-    Acquire.getBlockType, Acquire.putBlockType)
-  val dmem_union = Cat(Mux(state === s_get_acquire,
-    Cat(MT_Q, M_XRD), Acquire.fullWriteMask), Bool(true))
+  val dmem_type = Mux(state === s_put_acquire,
+    Acquire.putBlockType, Acquire.getBlockType)
+  // for puts, the alloc bit decides whether the received block is
+  // written into the L2 (where the consumer will find it) or around it
+  val dmem_union = Mux(state === s_put_acquire,
+    Cat(Acquire.fullWriteMask, alloc), Cat(MT_Q, M_XRD, Bool(true)))
 
-  io.dmem.acquire.valid := (state === s_get_acquire || state === s_put_acquire)
+  io.dmem.acquire.valid := (state === s_get_acquire ||
+                            state === s_put_acquire || filling)
   io.dmem.acquire.bits := Acquire(
     is_builtin_type = Bool(true),
     a_type = dmem_type,
     client_xact_id = UInt(1),
-    addr_block = addr_block,
-    addr_beat = beat_idx,
+    addr_block = Mux(filling, fill_block, addr_block),
+    addr_beat = Mux(filling, UInt(0), beat_idx),
     data = buffer(beat_idx),
     union = dmem_union)
-  io.dmem.grant.ready := (state === s_get_grant || state === s_put_grant)
+  io.dmem.grant.ready := (state === s_get_grant || state === s_put_grant ||
+                          fill_state === f_grant)
   debug(io.dmem.grant.bits.g_type)
 
-  io.dptw.req.valid := (state === s_ptw_req)
+  io.dptw.req.valid := (state === s_ptw_req) ||
+                       (fill_state === f_ptw_req && !fill_abort)
   io.dptw.req.bits.addr := vpn
   io.dptw.req.bits.prv := Bits(0)
-  io.dptw.req.bits.store := Bool(false)
-  io.dptw.req.bits.fetch := Bool(true)
+  // puts write local memory, so a read-only or copy-on-write page
+  // must fault rather than be written behind the kernel's back
+  io.dptw.req.bits.store := direction
+  io.dptw.req.bits.fetch := !direction
 
   switch (state) {
     is (s_idle) {
-      when (io.net.acquire.valid) {
-        val net_vpn = net_acquire.addr_block(tlBlockAddrBits - 1, blockPgIdxBits)
-        val net_page_idx = net_acquire.addr_block(blockPgIdxBits - 1, 0)
-        when (io.phys || vpn === net_vpn) {
-          addr_block := Mux(io.phys,
-            net_acquire.addr_block,
-            Cat(addr_block(tlBlockAddrBits - 1, blockPgIdxBits), net_page_idx))
+      // wait for the fill engine to wind down from an aborted stream
+      when (io.net.acquire.valid && fill_stopped) {
+        when (io.check_windows && !in_window) {
+          rejects := rejects + UInt(1)
+          beat_idx := UInt(0)
+          state := s_discard
+        } .elsewhen (!ctx_ok) {
+          beat_idx := UInt(0)
+          state := s_discard
+        } .elsewhen (ctx_phys) {
+          addr_block := net_acquire.addr_block
+          // addr_block no longer holds the cached page
+          vpn_valid := Bool(false)
+          state := s_prepare_recv
+        } .elsewhen (vpn_valid && vpn === net_vpn &&
+                     (vpn_store || !net_write)) {
+          addr_block := Cat(addr_block(tlBlockAddrBits - 1, blockPgIdxBits),
+                            net_page_idx)
+          state := s_prepare_recv
+        } .elsewhen (tlb_hit) {
+          addr_block := Cat(tlb_hit_ppn, net_page_idx)
+          vpn := net_vpn
+          vpn_valid := Bool(true)
+          vpn_store := tlb_hit_store
           state := s_prepare_recv
         } .otherwise {
           vpn := net_vpn
           page_idx := net_page_idx
+          walk_in_window := io.check_windows
+          walk_stale := Bool(false)
           state := s_ptw_req
         }
-        direction := (net_acquire.a_type != Acquire.getBlockType)
+        direction := net_write
+        stream := net_stream
+        accum := net_accum
+        accum_op := net_acquire.union(2, 1)
+        accum_type := net_acquire.union(4, 3)
         remote_addr := io.net.acquire.bits.header.src
         net_xact_id := net_acquire.client_xact_id
+        // these stay fixed for the whole transaction
+        phys := ctx_phys
+        alloc := ctx_alloc
+        local_addr.addr := Mux1H(ctx_sel, io.contexts.map(_.addr.addr))
+        local_addr.port := Mux1H(ctx_sel, io.contexts.map(_.addr.port))
       }
-      // we don't want this to change in the middle of a transaction
-      // so only update when in the idle state
-      local_addr := io.local_addr
     }
     is (s_prepare_recv) {
       beat_idx := UInt(0)
@@ -519,10 +1181,25 @@ class TileLinkDMARx extends DMAModule {
     is (s_ptw_resp) {
       when (io.dptw.resp.valid) {
         when (io.dptw.resp.bits.error) {
+          // don't reuse this translation if the sender retries
+          vpn_valid := Bool(false)
           beat_idx := UInt(0)
           state := s_discard
         } .otherwise {
           addr_block := Cat(io.dptw.resp.bits.pte.ppn, page_idx)
+          vpn_valid := !walk_stale
+          vpn_store := direction
+          when (walk_in_window && !walk_stale) {
+            // a put's walk replaces a read-only entry for the same page
+            for (i <- 0 until nRxWindows) {
+              when (tlb_vpn(i) === vpn) { tlb_valid(i) := Bool(false) }
+            }
+            tlb_valid(tlb_repl) := Bool(true)
+            tlb_vpn(tlb_repl) := vpn
+            tlb_ppn(tlb_repl) := io.dptw.resp.bits.pte.ppn
+            tlb_store(tlb_repl) := direction
+            tlb_repl := tlb_repl + UInt(1)
+          }
           state := s_prepare_recv
         }
       }
@@ -550,11 +1227,27 @@ class TileLinkDMARx extends DMAModule {
     is (s_recv) {
       when (io.net.acquire.valid) {
         when (direction) {
-          buffer.write(beat_idx, net_acquire.data, net_acquire.full_wmask())
+          // the block was read in first, so accumulating puts
+          // combine each beat with what is in the buffer
+          buffer.write(beat_idx, net_data, FillInterleaved(8, net_wmask))
+          crc := CRC32C(crc, net_acquire.data, net_wmask)
           when (beat_idx === UInt(tlDataBeats - 1)) {
             state := s_put_acquire
           }
           beat_idx := beat_idx + UInt(1)
+        } .elsewhen (stream) {
+          val nblocks = net_acquire.data(tlBlockAddrBits - 1, 0)
+          fill_block := addr_block
+          fill_left := nblocks
+          fill_half := Bool(false)
+          fill_error := Bool(false)
+          fill_abort := Bool(false)
+          drain_half := Bool(false)
+          drain_left := nblocks
+          half_full(0) := Bool(false)
+          half_full(1) := Bool(false)
+          beat_idx := UInt(0)
+          state := Mux(nblocks === UInt(0), s_idle, s_stream_ack)
         } .otherwise {
           state := s_get_acquire
         }
@@ -585,6 +1278,23 @@ class TileLinkDMARx extends DMAModule {
         state := s_ack
       }
     }
+    is (s_stream_ack) {
+      when (io.route_error) {
+        state := s_idle
+      } .elsewhen (io.net.grant.ready && io.net.grant.valid) {
+        when (stream_nack) {
+          state := s_idle
+        } .elsewhen (beat_idx === UInt(tlDataBeats - 1)) {
+          half_full(drain_half) := Bool(false)
+          drain_half := !drain_half
+          drain_left := drain_left - UInt(1)
+          when (drain_left === UInt(1)) {
+            state := s_idle
+          }
+        }
+        beat_idx := beat_idx + UInt(1)
+      }
+    }
     // this request cannot be processed, but we still need to consume
     // all of the acquire beats
     is (s_discard) {
@@ -597,4 +1307,83 @@ class TileLinkDMARx extends DMAModule {
       }
     }
   }
+
+  switch (fill_state) {
+    is (f_idle) {
+      when (fill_left != UInt(0) && !half_full(fill_half) && !fill_abort) {
+        fill_state := f_acquire
+      }
+    }
+    is (f_acquire) {
+      when (io.dmem.acquire.ready) {
+        fill_beat := UInt(0)
+        fill_state := f_grant
+      }
+    }
+    is (f_grant) {
+      when (io.dmem.grant.valid) {
+        stream_buffer(Cat(fill_half, fill_beat)) := io.dmem.grant.bits.data
+        when (fill_beat === UInt(tlDataBeats - 1)) {
+          val next_block = fill_block + UInt(1)
+          val page_end = next_block(blockPgIdxBits - 1, 0) === UInt(0)
+          half_full(fill_half) := Bool(true)
+          fill_half := !fill_half
+          fill_block := next_block
+          fill_left := Mux(fill_abort, UInt(0), fill_left - UInt(1))
+          when (!fill_abort && !phys && page_end && fill_left > UInt(1)) {
+            vpn := vpn + UInt(1)
+            fill_state := f_ptw_req
+          } .otherwise {
+            fill_state := f_idle
+          }
+        }
+        fill_beat := fill_beat + UInt(1)
+      }
+    }
+    is (f_ptw_req) {
+      when (fill_abort) {
+        // vpn already points at the next page
+        vpn_valid := Bool(false)
+        fill_state := f_idle
+      } .elsewhen (io.dptw.req.ready) {
+        fill_state := f_ptw_resp
+      }
+    }
+    is (f_ptw_resp) {
+      when (io.dptw.resp.valid) {
+        when (fill_abort) {
+          // the stream is gone, so leave the translation alone
+          vpn_valid := Bool(false)
+        } .elsewhen (io.dptw.resp.bits.error) {
+          fill_error := Bool(true)
+          fill_left := UInt(0)
+          vpn_valid := Bool(false)
+        } .otherwise {
+          val next_block = Cat(io.dptw.resp.bits.pte.ppn,
+                               UInt(0, blockPgIdxBits))
+          fill_block := next_block
+          addr_block := next_block
+        }
+        fill_state := f_idle
+      }
+    }
+  }
+
+  // stop the fill engine from starting any more reads; the receiver
+  // takes no new request until the block in flight has been read
+  when (state === s_stream_ack && io.route_error) {
+    fill_left := UInt(0)
+    fill_abort := Bool(true)
+  }
+
+  when (io.crc_clear) {
+    crc := CRC32C.init
+  }
+
+  // the windows, the address space or its page table changed under us
+  when (io.flush || io.dptw.invalidate) {
+    vpn_valid := Bool(false)
+    tlb_valid.foreach(_ := Bool(false))
+    walk_stale := Bool(true)
+  }
 }
@@ -0,0 +1,329 @@
+package dma
+
+import Chisel._
+import uncore._
+import scala.collection.mutable.{Queue => MQueue}
+
+// A point-to-point link that delays each beat by latency + 1 cycles
+// and carries at most one beat every beatInterval cycles
+class LinkModel[T <: Data](gen: T, latency: Int, beatInterval: Int)
+    extends Module {
+  val io = new Bundle {
+    val in = Decoupled(gen.cloneType).flip
+    val out = Decoupled(gen.cloneType)
+  }
+
+  val throttle = Reg(init = UInt(0, log2Up(beatInterval + 1)))
+  val beat_ok = (throttle === UInt(0))
+
+  when (!beat_ok) { throttle := throttle - UInt(1) }
+  when (io.in.fire()) { throttle := UInt(beatInterval - 1) }
+
+  val ingress = Module(new Queue(gen, 2))
+  ingress.io.enq.valid := io.in.valid && beat_ok
+  ingress.io.enq.bits := io.in.bits
+  io.in.ready := ingress.io.enq.ready && beat_ok
+
+  io.out <> NetworkDelay(ingress.io.deq, latency)
+}
+
+// Connects every input to the output named by its dest.
+// Outputs arbitrate round robin between inputs, and a multi-beat
+// packet keeps its output until all of its beats have gone through.
+class PacketCrossbar[T <: Data](gen: T, n: Int, beats: Int) extends Module {
+  val io = new Bundle {
+    val in = Vec.fill(n) { Decoupled(gen.cloneType).flip }
+    val dest = Vec.fill(n) { UInt(INPUT, log2Up(n)) }
+    val multibeat = Vec.fill(n) { Bool(INPUT) }
+    val out = Vec.fill(n) { Decoupled(gen.cloneType) }
+  }
+
+  val readies = Vec.fill(n) { Vec.fill(n) { Bool() } }
+
+  for (j <- 0 until n) {
+    val arb = Module(new RRArbiter(gen, n))
+    val locked = Reg(init = Bool(false))
+    val owner = Reg(UInt(width = log2Up(n)))
+    val beat = Reg(init = UInt(0, log2Up(beats)))
+
+    for (i <- 0 until n) {
+      arb.io.in(i).valid := io.in(i).valid && io.dest(i) === UInt(j) &&
+                            (!locked || owner === UInt(i))
+      arb.io.in(i).bits := io.in(i).bits
+      readies(j)(i) := arb.io.in(i).ready && arb.io.in(i).valid
+    }
+
+    io.out(j) <> arb.io.out
+
+    when (io.out(j).fire() && io.multibeat(arb.io.chosen)) {
+      when (beat === UInt(beats - 1)) {
+        locked := Bool(false)
+        beat := UInt(0)
+      } .otherwise {
+        locked := Bool(true)
+        owner := arb.io.chosen
+        beat := beat + UInt(1)
+      }
+    }
+  }
+
+  for (i <- 0 until n) {
+    io.in(i).ready := readies.map(_(i)).reduce(_ || _)
+  }
+}
+
+// A single switch between n nodes. Packets are routed by looking up the
+// destination address and port among the addresses the nodes are bound to.
+// A packet with no matching node is not accepted; instead route_error is
+// raised to its sender (bit 0 for the transmitter, bit 1 for the receiver).
+// Each packet crosses two links, one into and one out of the switch.
+class DMASwitch(n: Int, hopLatency: Int, linkBeatInterval: Int)
+    extends DMAModule {
+  val io = new Bundle {
+    val tx = Vec.fill(n) { new RemoteTileLinkIO().flip }
+    val rx = Vec.fill(n) { new RemoteTileLinkIO }
+    val addrs = Vec.fill(n) { new RemoteAddress().asInput }
+    val route_error = Vec.fill(n) { Bits(OUTPUT, 2) }
+  }
+
+  def lookup(dst: RemoteAddress): (Bool, UInt) = {
+    val hits = Vec(io.addrs.map(a => a.addr === dst.addr && a.port === dst.port))
+    (hits.toBits.orR, PriorityEncoder(hits.toBits))
+  }
+
+  def link[T <: Data](in: DecoupledIO[T], ok: Bool = Bool(true)) = {
+    val l = Module(new LinkModel(in.bits, hopLatency, linkBeatInterval))
+    l.io.in.valid := in.valid && ok
+    l.io.in.bits := in.bits
+    in.ready := l.io.in.ready && ok
+    l.io.out
+  }
+
+  val acqXbar = Module(new PacketCrossbar(io.tx(0).acquire.bits, n, tlDataBeats))
+  val gntXbar = Module(new PacketCrossbar(io.rx(0).grant.bits, n, tlDataBeats))
+
+  for (i <- 0 until n) {
+    val acq = io.tx(i).acquire
+    val gnt = io.rx(i).grant
+    val (acq_ok, _) = lookup(acq.bits.header.dst)
+    val (gnt_ok, _) = lookup(gnt.bits.header.dst)
+
+    io.route_error(i) := Cat(gnt.valid && !gnt_ok, acq.valid && !acq_ok)
+
+    val acq_in = link(acq, acq_ok)
+    acqXbar.io.in(i) <> acq_in
+    acqXbar.io.dest(i) := lookup(acq_in.bits.header.dst)._2
+    acqXbar.io.multibeat(i) :=
+      acq_in.bits.payload.a_type === Acquire.putBlockType ||
+      acq_in.bits.payload.a_type === RemoteAcquire.putAccumType
+    io.rx(i).acquire <> link(acqXbar.io.out(i))
+
+    val gnt_in = link(gnt, gnt_ok)
+    gntXbar.io.in(i) <> gnt_in
+    gntXbar.io.dest(i) := lookup(gnt_in.bits.header.dst)._2
+    gntXbar.io.multibeat(i) := gnt_in.bits.payload.g_type === Grant.getDataBlockType
+    io.tx(i).grant <> link(gntXbar.io.out(i))
+  }
+}
+
+// n nodes, each with its own memory, connected through one switch
+class DMANetworkHarness(
+    val n: Int,
+    hopLatency: Int = 8,
+    linkBeatInterval: Int = 1,
+    val memBeats: Int = 8192,
+    memLatency: Int = 20) extends DMAModule {
+  val io = new Bundle {
+    val nodes = Vec.fill(n) { new DMANodeIO }
+  }
+
+  val nodes = (0 until n).map { _ =>
+    Module(new DMANode(memBeats = memBeats, memLatency = memLatency))
+  }
+  val switch = Module(new DMASwitch(n, hopLatency, linkBeatInterval))
+
+  for (i <- 0 until n) {
+    nodes(i).io.ctrl <> io.nodes(i)
+    switch.io.tx(i) <> nodes(i).io.net_tx
+    nodes(i).io.net_rx <> switch.io.rx(i)
+    switch.io.addrs(i) := io.nodes(i).local_addr
+    nodes(i).io.route_error := switch.io.route_error(i)
+  }
+}
+
+// A put to, or get from, the node bound to basePort + remote_node.
+// src and dst are addresses on the sending and receiving side of the data.
+// error is the transmit error the transfer is expected to end with.
+case class DMANetworkTransfer(remote_node: Int, src: Int, dst: Int,
+    nbytes: Int, put: Boolean = true, error: Int = 0)
+
+// Runs incast, all-to-all, ring and streaming get traffic patterns over
+// the network harness, checks the received data, and reports the aggregate
+// bandwidth. Also checks that a put to an unbound port fails with no route.
+class DMANetworkTester(c: DMANetworkHarness) extends Tester(c, false) {
+  val beatBytes = c.tlDataBytes
+  val memBytes = c.memBeats * beatBytes
+  val srcBase = 0x1000
+  val dstBase = memBytes / 2
+  val basePort = 100
+  val timeout = 1000000
+
+  def pattern(node: Int, addr: Int): Int = (addr * 7 + 3 + node * 31) & 0xff
+
+  def beatValue(f: Int => Int, beat: Int): BigInt =
+    (0 until beatBytes).foldLeft(BigInt(0)) { (acc, i) =>
+      acc | (BigInt(f(beat * beatBytes + i)) << (8 * i))
+    }
+
+  def mem(node: Int) = c.nodes(node).memory.mem
+
+  def initSource(node: Int, nbytes: Int) {
+    for (beat <- srcBase / beatBytes to (srcBase + nbytes - 1) / beatBytes)
+      pokeAt(mem(node), beatValue(a => pattern(node, a), beat), beat)
+  }
+
+  def clearDest(node: Int, nbytes: Int) {
+    for (beat <- dstBase / beatBytes to (dstBase + nbytes - 1) / beatBytes)
+      pokeAt(mem(node), BigInt(0), beat)
+  }
+
+  def checkTransfer(node: Int, xfer: DMANetworkTransfer): Boolean = {
+    val src_node = if (xfer.put) node else xfer.remote_node
+    val dst_node = if (xfer.put) xfer.remote_node else node
+    var ok = true
+    for (i <- 0 until xfer.nbytes) {
+      val addr = xfer.dst + i
+      val beat = peekAt(mem(dst_node), addr / beatBytes)
+      val got = ((beat >> (8 * (addr % beatBytes))) & 0xff).toInt
+      val expected = pattern(src_node, xfer.src + i)
+      if (got != expected && ok) {
+        println("node %d -> %d: byte %x expected %x, got %x".format(
+          src_node, dst_node, addr, expected, got))
+        ok = false
+      }
+    }
+    ok
+  }
+
+  // Issue each node's transfers one after another, starting the next only
+  // when the previous one has finished, as software would with a fence
+  def run(name: String, xfers: Seq[Seq[DMANetworkTransfer]],
+      nbytes: Int): Boolean = {
+    for (i <- 0 until c.n) {
+      initSource(i, nbytes)
+      clearDest(i, nbytes * c.n)
+      poke(c.io.nodes(i).phys, 1)
+      poke(c.io.nodes(i).local_addr.addr, 0)
+      poke(c.io.nodes(i).local_addr.port, basePort + i)
+      poke(c.io.nodes(i).src_stride, 0)
+      poke(c.io.nodes(i).dst_stride, 0)
+      poke(c.io.nodes(i).nsegments, 1)
+      poke(c.io.nodes(i).cmd.valid, 0)
+    }
+
+    val pending = xfers.map(x => MQueue(x: _*))
+    val issued = Array.fill(c.n) { false }
+    val last = Array.fill[Option[DMANetworkTransfer]](c.n) { None }
+    var cycles = 0
+    var failed = false
+
+    def active = (0 until c.n).exists(i =>
+      pending(i).nonEmpty || issued(i) || peek(c.io.nodes(i).busy) == 1)
+
+    while (active && cycles < timeout && !failed) {
+      for (i <- 0 until c.n) {
+        val node = c.io.nodes(i)
+        if (issued(i)) {
+          poke(node.cmd.valid, 0)
+          issued(i) = false
+        } else if (peek(node.busy) == 0) {
+          for (xfer <- last(i) if peek(node.error) != xfer.error) {
+            println("node %d: expected error %d, got %d".format(
+              i, xfer.error, peek(node.error)))
+            failed = true
+          }
+          last(i) = None
+          if (pending(i).nonEmpty) {
+            val xfer = pending(i).dequeue()
+            poke(node.remote_addr.addr, 0)
+            poke(node.remote_addr.port, basePort + xfer.remote_node)
+            poke(node.segment_size, xfer.nbytes)
+            poke(node.cmd.bits.src, xfer.src)
+            poke(node.cmd.bits.dst, xfer.dst)
+            poke(node.cmd.bits.direction, if (xfer.put) 1 else 0)
+            poke(node.cmd.valid, 1)
+            issued(i) = true
+            last(i) = Some(xfer)
+          }
+        }
+      }
+      step(1)
+      cycles += 1
+    }
+
+    if (cycles >= timeout) {
+      println(name + ": timed out")
+      return false
+    }
+
+    for (i <- 0 until c.n; xfer <- xfers(i) if xfer.error == 0)
+      if (!checkTransfer(i, xfer)) failed = true
+
+    val total = xfers.map(_.filter(_.error == 0).map(_.nbytes).sum).sum
+    println("%-10s %3d nodes %8d bytes %8d cycles %8.2f B/cycle".format(
+      name, c.n, total, cycles, total.toDouble / cycles))
+    !failed
+  }
+
+  val nbytes = math.min(4096, (memBytes - dstBase) / c.n)
+
+  val incast = (0 until c.n).map { i =>
+    if (i == 0) Seq()
+    else Seq(DMANetworkTransfer(0, srcBase, dstBase + i * nbytes, nbytes))
+  }
+  val allToAll = (0 until c.n).map { i =>
+    (1 until c.n).map { k =>
+      val j = (i + k) % c.n
+      DMANetworkTransfer(j, srcBase, dstBase + i * nbytes, nbytes)
+    }
+  }
+  val ring = (0 until c.n).map { i =>
+    Seq(DMANetworkTransfer((i + 1) % c.n, srcBase, dstBase, nbytes))
+  }
+  // each node streams the source of the next one into its own memory
+  val ringGet = (0 until c.n).map { i =>
+    Seq(DMANetworkTransfer((i + 1) % c.n, srcBase, dstBase, nbytes,
+      put = false))
+  }
+  // no node is bound to the port after the last one
+  val noRoute = (0 until c.n).map { i =>
+    if (i == 0) Seq(DMANetworkTransfer(c.n, srcBase, dstBase, nbytes,
+      error = 3))
+    else Seq()
+  }
+
+  ok = run("ring", ring, nbytes) &&
+       run("incast", incast, nbytes) &&
+       run("all-to-all", allToAll, nbytes) &&
+       run("ring-get", ringGet, nbytes) &&
+       run("no-route", noRoute, nbytes)
+}
+
+// usage: DMANetworkMain ConfigClass nodes hopLatency linkCyclesPerBeat
+//                       memLatency [chisel args]
+object DMANetworkMain {
+  def main(args: Array[String]) {
+    val config = Class.forName(args(0)).newInstance.asInstanceOf[ChiselConfig]
+    val nodes = args(1).toInt
+    val hopLatency = args(2).toInt
+    val linkBeatInterval = args(3).toInt
+    val memLatency = args(4).toInt
+    val params = Parameters.root(config.toInstance)
+
+    chiselMainTest(args.drop(5), () => Module(new DMANetworkHarness(
+        nodes, hopLatency, linkBeatInterval,
+        memLatency = memLatency))(params)) {
+      c => new DMANetworkTester(c)
+    }
+  }
+}
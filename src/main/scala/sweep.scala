@@ -0,0 +1,150 @@
+package dma
+
+import Chisel._
+import uncore._
+import scala.collection.mutable.ArrayBuffer
+import java.io.{File, PrintWriter}
+
+case class DMASweepPoint(
+    config: String, dataBits: Int, queueDepth: Int, maxXacts: Int) {
+  def name = "%s-d%d-q%d-x%d".format(
+    config.split('.').last, dataBits, queueDepth, maxXacts)
+}
+
+case class DMASweepResult(
+    point: DMASweepPoint,
+    tlBits: Int = 0, tlBeats: Int = 0,
+    regBits: Int = 0, memBits: Int = 0,
+    cycles: Seq[Option[Int]] = Nil,
+    error: String = "")
+
+object DMASweep {
+  // a fixed benchmark: single block latency, then contiguous
+  // and strided bandwidth, all through physical addresses
+  val latencyCases = Seq(
+    DMATestCase(64, 0, 0, 0, 0, 1, true, true),
+    DMATestCase(64, 0, 0, 0, 0, 1, false, true))
+  val bandwidthCases = Seq(
+    DMATestCase(8192, 0, 0, 0, 0, 1, true, true),
+    DMATestCase(8192, 0, 0, 0, 0, 1, false, true),
+    DMATestCase(1000, 3, 5, 0, 0, 1, true, true),
+    DMATestCase(256, 0, 0, 200, 100, 16, true, true),
+    DMATestCase(256, 0, 0, 200, 100, 16, false, true))
+  val cases = latencyCases ++ bandwidthCases
+
+  val header = Seq(
+    "config", "dma bits", "queue", "xacts", "tl bits", "beats",
+    "put lat", "get lat", "put B/c", "get B/c", "unalign",
+    "strd put", "strd get", "reg bits", "mem bits", "status")
+
+  def columns(r: DMASweepResult): Seq[String] = {
+    val p = r.point
+    val lat = r.cycles.take(latencyCases.size).map(
+      _.map(_.toString).getOrElse("-"))
+    val bw = r.cycles.drop(latencyCases.size).zip(bandwidthCases).map {
+      case (Some(cycles), tc) =>
+        "%.2f".format(tc.nbytes * tc.nsegments / cycles.toDouble)
+      case (None, _) => "-"
+    }
+    val status =
+      if (r.error != "") r.error
+      else if (r.cycles.size == cases.size && r.cycles.forall(_.isDefined)) "ok"
+      else "FAILED"
+    val padded = (lat ++ bw).padTo(cases.size, "-")
+
+    Seq(p.config.split('.').last, p.dataBits.toString,
+        p.queueDepth.toString, p.maxXacts.toString,
+        r.tlBits.toString, r.tlBeats.toString) ++ padded ++
+    Seq(r.regBits.toString, r.memBits.toString, status)
+  }
+
+  // state bits in the engine itself, leaving out the testbench models;
+  // only valid after an elaboration that keeps the module hierarchy
+  def countBits(): (Int, Int) = {
+    val engine = Driver.components.filterNot(m =>
+      m.isInstanceOf[BehavioralTileLinkMemory] || m.isInstanceOf[StubPTW])
+    val nodes = engine.flatMap(_.nodes).distinct
+    val regBits = nodes.collect { case r: Reg => r.needWidth() }.sum
+    val memBits = nodes.collect {
+      case m: Mem[_] => m.n * m.needWidth()
+    }.sum
+    (regBits, memBits)
+  }
+
+  def run(point: DMASweepPoint, root: Parameters,
+          targetDir: String, chiselArgs: Array[String]): DMASweepResult = {
+    val params = root.alterPartial({
+      case DMADataBits => point.dataBits
+      case DMAQueueDepth => point.queueDepth
+      case DMAMaxXacts => point.maxXacts
+    })
+    val dir = targetDir + "/" + point.name
+    def harness() = Module(new DMATestHarness)(params)
+
+    try {
+      // elaborate to Verilog first, which keeps the hierarchy,
+      // to count the state bits of the engine
+      chiselMain(Array("--backend", "v", "--targetDir", dir), harness _)
+      val (regBits, memBits) = countBits()
+
+      var tester: DMATestHarnessTester = null
+      val top = chiselMainTest(chiselArgs ++ Array("--targetDir", dir),
+          harness _) { c =>
+        tester = new DMATestHarnessTester(c, cases, false)
+        tester
+      }
+      DMASweepResult(point, top.tlDataBits, top.tlDataBeats,
+        regBits, memBits, if (tester == null) Nil else tester.results)
+    } catch {
+      // combinations that do not elaborate show up in the table
+      case e: Exception =>
+        println(point.name + ": " + e)
+        DMASweepResult(point, error = e.getClass.getSimpleName)
+    }
+  }
+}
+
+// Builds and runs an emulator for every combination of the given
+// configurations and parameter values, and tabulates the results.
+// Lists are comma-separated; the TileLink parameters come from the configs.
+//
+// usage: DMASweepMain ConfigClasses dataBits queueDepths maxXacts
+//                     targetDir [chisel args]
+object DMASweepMain {
+  def main(args: Array[String]) {
+    def list(arg: String) = arg.split(',').map(_.toInt).toSeq
+    val configs = args(0).split(',').toSeq
+    val targetDir = args(4)
+    val chiselArgs = args.drop(5)
+
+    val results = ArrayBuffer[DMASweepResult]()
+    for (config <- configs) {
+      val root = Parameters.root(Class.forName(config).newInstance
+        .asInstanceOf[ChiselConfig].toInstance)
+      for (dataBits <- list(args(1));
+           queueDepth <- list(args(2));
+           maxXacts <- list(args(3))) {
+        val point = DMASweepPoint(config, dataBits, queueDepth, maxXacts)
+        println("sweep: " + point.name)
+        results += DMASweep.run(point, root, targetDir, chiselArgs)
+      }
+    }
+
+    val rows = DMASweep.header +: results.map(DMASweep.columns)
+    val widths = DMASweep.header.indices.init.map(i => rows.map(_(i).size).max)
+
+    for (row <- rows)
+      println(row.zip(widths :+ 0).map {
+        case (col, w) => col.padTo(w, ' ')
+      }.mkString(" "))
+
+    new File(targetDir).mkdirs()
+    val csv = new PrintWriter(new File(targetDir, "sweep.csv"))
+    for (row <- rows)
+      csv.println(row.mkString(","))
+    csv.close()
+
+    if (results.exists(r => DMASweep.columns(r).last != "ok"))
+      sys.exit(1)
+  }
+}
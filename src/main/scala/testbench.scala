@@ -0,0 +1,490 @@
+package dma
+
+import Chisel._
+import rocket.{TLBPTWIO, MStatus, PTE}
+import uncore._
+import scala.collection.mutable.ArrayBuffer
+
+// A TileLink memory that takes latency cycles to answer each request
+// and moves at most one beat every beatInterval cycles.
+// Only one request is handled at a time.
+class BehavioralTileLinkMemory(nBeats: Int, latency: Int, beatInterval: Int)
+    extends DMAModule {
+  val io = new Bundle {
+    val tl = new ClientUncachedTileLinkIO().flip
+  }
+
+  private val idxBits = log2Up(nBeats)
+
+  val mem = Mem(Bits(width = tlDataBits), nBeats)
+
+  val (s_idle :: s_put_data :: s_wait :: s_grant :: Nil) = Enum(Bits(), 4)
+  val state = Reg(init = s_idle)
+
+  val acq = Reg(new Acquire)
+  val beat = Reg(UInt(width = tlBeatAddrBits))
+  val wait_count = Reg(UInt(width = log2Up(latency + 1)))
+  val throttle = Reg(init = UInt(0, log2Up(beatInterval + 1)))
+  val beat_ok = (throttle === UInt(0))
+
+  when (!beat_ok) { throttle := throttle - UInt(1) }
+
+  val acquire = io.tl.acquire.bits
+  val acq_index = Cat(acquire.addr_block, acquire.addr_beat)(idxBits - 1, 0)
+  val is_multibeat_put = acquire.a_type === Acquire.putBlockType
+  val is_put = is_multibeat_put || acquire.a_type === Acquire.putType
+
+  io.tl.acquire.ready := beat_ok &&
+    (state === s_idle || state === s_put_data)
+
+  when (io.tl.acquire.fire()) {
+    when (is_put) {
+      mem.write(acq_index, acquire.data, acquire.full_wmask())
+    }
+    throttle := UInt(beatInterval - 1)
+  }
+
+  val g_type = MuxLookup(acq.a_type, Grant.putAckType,
+    (Acquire.getBlockType, Grant.getDataBlockType) ::
+    (Acquire.getType, Grant.getDataBeatType) :: Nil)
+  val is_block_get = acq.a_type === Acquire.getBlockType
+
+  io.tl.grant.valid := (state === s_grant) && beat_ok
+  io.tl.grant.bits := Grant(
+    is_builtin_type = Bool(true),
+    g_type = g_type,
+    client_xact_id = acq.client_xact_id,
+    manager_xact_id = UInt(0),
+    addr_beat = beat,
+    data = mem(Cat(acq.addr_block, beat)(idxBits - 1, 0)))
+
+  when (io.tl.grant.fire()) {
+    throttle := UInt(beatInterval - 1)
+  }
+
+  switch (state) {
+    is (s_idle) {
+      when (io.tl.acquire.fire()) {
+        acq := acquire
+        beat := acquire.addr_beat
+        wait_count := UInt(latency)
+        when (is_multibeat_put && acquire.addr_beat != UInt(tlDataBeats - 1)) {
+          state := s_put_data
+        } .otherwise {
+          state := s_wait
+        }
+      }
+    }
+    is (s_put_data) {
+      when (io.tl.acquire.fire() &&
+            acquire.addr_beat === UInt(tlDataBeats - 1)) {
+        state := s_wait
+      }
+    }
+    is (s_wait) {
+      when (wait_count === UInt(0)) {
+        when (is_block_get) { beat := UInt(0) }
+        state := s_grant
+      }
+      wait_count := wait_count - UInt(1)
+    }
+    is (s_grant) {
+      when (io.tl.grant.fire()) {
+        when (!is_block_get || beat === UInt(tlDataBeats - 1)) {
+          state := s_idle
+        }
+        beat := beat + UInt(1)
+      }
+    }
+  }
+}
+
+// Answers page table walks with an identity mapping after latency cycles.
+// Pages at or above nPages fault.
+class StubPTW(latency: Int, nPages: Int) extends DMAModule {
+  val io = new Bundle {
+    val ptw = new TLBPTWIO().flip
+  }
+
+  val vpn = Reg(UInt(width = vpnBits))
+  val count = Reg(UInt(width = log2Up(latency + 1)))
+  val busy = Reg(init = Bool(false))
+
+  io.ptw.req.ready := !busy
+  io.ptw.resp.valid := busy && count === UInt(0)
+  io.ptw.resp.bits.error := vpn >= UInt(nPages)
+  io.ptw.resp.bits.pte := (new PTE).fromBits(UInt(0))
+  io.ptw.resp.bits.pte.ppn := vpn
+  io.ptw.status := (new MStatus).fromBits(UInt(0))
+  io.ptw.invalidate := Bool(false)
+
+  when (io.ptw.req.fire()) {
+    vpn := io.ptw.req.bits.addr
+    count := UInt(latency)
+    busy := Bool(true)
+  }
+
+  when (busy) {
+    when (count === UInt(0)) {
+      busy := Bool(false)
+    } .otherwise {
+      count := count - UInt(1)
+    }
+  }
+}
+
+object NetworkDelay {
+  def apply[T <: Data](in: DecoupledIO[T], stages: Int): DecoupledIO[T] =
+    (0 until stages).foldLeft(in) { (d, _) => Queue(d, 2) }
+}
+
+class DMANodeIO extends DMABundle {
+  val cmd = Decoupled(new SegmentSenderCommand).flip
+  val segment_size = UInt(INPUT, paddrBits)
+  val src_stride = UInt(INPUT, paddrBits)
+  val dst_stride = UInt(INPUT, paddrBits)
+  val nsegments = UInt(INPUT, paddrBits)
+  val phys = Bool(INPUT)
+  val local_addr = new RemoteAddress().asInput
+  val remote_addr = new RemoteAddress().asInput
+  val max_retries = UInt(INPUT, 8)
+  val backoff = UInt(INPUT, 16)
+  val error = TxErrors.noerror.cloneType.asOutput
+  val bytes_done = UInt(OUTPUT, paddrBits)
+  val busy = Bool(OUTPUT)
+}
+
+// SegmentSender, Tx and Rx sharing one behavioral memory
+// and a stub page table walker, with the network left open
+class DMANode(
+    val memBeats: Int = 8192,
+    memLatency: Int = 20,
+    memBeatInterval: Int = 1,
+    ptwLatency: Int = 10) extends DMAModule {
+  val io = new Bundle {
+    val ctrl = new DMANodeIO
+    val net_tx = new RemoteTileLinkIO
+    val net_rx = new RemoteTileLinkIO().flip
+    val route_error = Bits(INPUT, 2)
+  }
+
+  val memory = Module(new BehavioralTileLinkMemory(
+    memBeats, memLatency, memBeatInterval))
+  val memPages = (memBeats * tlDataBytes) >> pgIdxBits
+  val ptw = Module(new StubPTW(ptwLatency, memPages))
+
+  val csrs = new DMACSRs
+  csrs.segment_size := io.ctrl.segment_size
+  csrs.src_stride := io.ctrl.src_stride
+  csrs.dst_stride := io.ctrl.dst_stride
+  csrs.nsegments := io.ctrl.nsegments
+  csrs.header.dst := io.ctrl.remote_addr
+  csrs.header.src := io.ctrl.local_addr
+  csrs.phys := io.ctrl.phys
+  csrs.alloc := Bool(true)
+  csrs.transpose := Bool(false)
+  csrs.elem_size := UInt(0)
+  csrs.accum := Bool(false)
+  csrs.accum_op := UInt(0)
+  csrs.accum_type := UInt(0)
+  csrs.max_retries := io.ctrl.max_retries
+  csrs.backoff := io.ctrl.backoff
+
+  val sender = Module(new SegmentSender)
+  sender.io.csrs := csrs
+  sender.io.cmd <> io.ctrl.cmd
+  // a node has only the one context
+  sender.io.cmd.bits.ctx := UInt(0)
+
+  val tx = Module(new TileLinkDMATx)
+  tx.io.cmd <> sender.io.dma
+  tx.io.net <> io.net_tx
+  tx.io.phys := io.ctrl.phys
+  tx.io.walk_ok := Bool(true)
+  tx.io.alloc := Bool(true)
+  tx.io.max_retries := io.ctrl.max_retries
+  tx.io.backoff := io.ctrl.backoff
+  tx.io.route_error := io.route_error(0)
+
+  val rx = Module(new TileLinkDMARx)
+  rx.io.net <> io.net_rx
+  for ((c, i) <- rx.io.contexts.zipWithIndex) {
+    c.valid := Bool(i == 0)
+    c.addr := io.ctrl.local_addr
+    c.phys := io.ctrl.phys
+    c.alloc := Bool(true)
+    c.active := Bool(i == 0)
+  }
+  rx.io.route_error := io.route_error(1)
+  rx.io.crc_clear := Bool(false)
+  rx.io.check_windows := Bool(false)
+  rx.io.flush := Bool(false)
+  for (w <- rx.io.windows) {
+    w.base := UInt(0)
+    w.size := UInt(0)
+    w.port := UInt(0)
+    w.key := UInt(0)
+    w.read := Bool(false)
+    w.write := Bool(false)
+  }
+
+  val dmemArb = Module(new ClientUncachedTileLinkIOArbiter(2))
+  dmemArb.io.in(0) <> tx.io.dmem
+  dmemArb.io.in(1) <> rx.io.dmem
+  memory.io.tl <> dmemArb.io.out
+
+  val ptwArb = Module(new PTWArbiter(2))
+  ptwArb.io.requestors(0) <> tx.io.dptw
+  ptwArb.io.requestors(1) <> rx.io.dptw
+  ptw.io.ptw <> ptwArb.io.ptw
+
+  io.ctrl.error := tx.io.error
+  io.ctrl.bytes_done := tx.io.bytes_done
+  io.ctrl.busy := sender.io.busy || !tx.io.cmd.ready
+}
+
+// A single node with its transmitter looped back to its receiver
+class DMATestHarness(
+    val memBeats: Int = 8192,
+    memLatency: Int = 20,
+    memBeatInterval: Int = 1,
+    netLatency: Int = 4,
+    ptwLatency: Int = 10) extends DMAModule {
+  val io = new DMANodeIO {
+    val nacks = UInt(INPUT, 8)
+  }
+
+  val node = Module(new DMANode(
+    memBeats, memLatency, memBeatInterval, ptwLatency))
+  node.io.ctrl <> io
+  node.io.route_error := Bits(0)
+
+  node.io.net_rx.acquire <> NetworkDelay(node.io.net_tx.acquire, netLatency)
+  val grant = NetworkDelay(node.io.net_rx.grant, netLatency)
+  node.io.net_tx.grant <> grant
+
+  // turn the first io.nacks put acks of each transfer into nacks,
+  // so the sender has to resend blocks the receiver already took
+  val nacks_left = Reg(init = UInt(0, 8))
+  val nack_ack = nacks_left != UInt(0) &&
+    grant.bits.payload.g_type === Grant.putAckType
+  when (nack_ack) {
+    node.io.net_tx.grant.bits.payload.g_type := Grant.nackType
+  }
+  when (io.cmd.fire()) {
+    nacks_left := io.nacks
+  } .elsewhen (grant.fire() && nack_ack) {
+    nacks_left := nacks_left - UInt(1)
+  }
+}
+
+case class DMATestCase(
+    nbytes: Int, srcOff: Int, dstOff: Int,
+    srcStride: Int, dstStride: Int, nsegments: Int,
+    put: Boolean, phys: Boolean, nacks: Int = 0, fault: Boolean = false)
+
+object DMATestCase {
+  def standard: Seq[DMATestCase] = {
+    val cases = ArrayBuffer[DMATestCase]()
+    for (put <- Seq(true, false);
+         nbytes <- Seq(64, 256, 1000, 4096);
+         (srcOff, dstOff) <- Seq((0, 0), (3, 0), (0, 5), (13, 7)))
+      cases += DMATestCase(nbytes, srcOff, dstOff, 0, 0, 1, put, true)
+    for (put <- Seq(true, false);
+         (srcStride, dstStride) <- Seq((64, 0), (0, 64), (200, 100)))
+      cases += DMATestCase(256, 0, 0, srcStride, dstStride, 8, put, true)
+    for (put <- Seq(true, false))
+      cases += DMATestCase(8192, 0, 0, 0, 0, 1, put, false)
+    // sources whose second page is unmapped, so the fill side fails
+    // part way through. the cases after these check nothing hung
+    for (put <- Seq(true, false); srcOff <- Seq(0, 3))
+      cases += DMATestCase(8192, srcOff, 0, 0, 0, 1, put, false, fault = true)
+    // puts whose first blocks are nacked and then retried
+    for ((srcOff, dstOff) <- Seq((0, 0), (13, 7)))
+      cases += DMATestCase(1000, srcOff, dstOff, 0, 0, 1, true, true, 2)
+    cases
+  }
+}
+
+// Runs a set of transfers (the standard one by default) through the harness,
+// checks the destination against a model of the memory,
+// and reports the number of cycles each one took
+class DMATestHarnessTester(
+    c: DMATestHarness,
+    cases: Seq[DMATestCase] = DMATestCase.standard,
+    verbose: Boolean = true) extends Tester(c, false) {
+  val beatBytes = c.tlDataBytes
+  val memBytes = c.memBeats * beatBytes
+  val srcBase = 0x1000
+  val dstBase = memBytes / 2
+  val blockBytes = beatBytes * c.tlDataBeats
+  val pageBytes = 1 << c.pgIdxBits
+  val timeout = 200000
+
+  val model = Array.tabulate(memBytes) { i => ((i * 7 + 3) & 0xff).toByte }
+
+  def beatValue(beat: Int): BigInt =
+    (0 until beatBytes).foldLeft(BigInt(0)) { (acc, i) =>
+      acc | (BigInt(model(beat * beatBytes + i) & 0xff) << (8 * i))
+    }
+
+  def writeBeats(start: Int, end: Int) {
+    for (beat <- start / beatBytes to (end - 1) / beatBytes)
+      pokeAt(c.node.memory.mem, beatValue(beat), beat)
+  }
+
+  def checkBeats(start: Int, end: Int): Boolean = {
+    var ok = true
+    for (beat <- start / beatBytes to (end - 1) / beatBytes) {
+      val got = peekAt(c.node.memory.mem, beat)
+      if (got != beatValue(beat)) {
+        println("beat " + beat + ": expected " + beatValue(beat).toString(16) +
+                ", got " + got.toString(16))
+        ok = false
+      }
+    }
+    ok
+  }
+
+  def run(tc: DMATestCase): Option[Int] = {
+    // a faulting source starts in the last page of memory, and the
+    // page walker faults everything after it
+    val src = (if (tc.fault) memBytes - pageBytes else srcBase) + tc.srcOff
+    val dst = dstBase + tc.dstOff
+    val srcEnd = src + (tc.nbytes + tc.srcStride) * tc.nsegments
+    val dstEnd = dst + (tc.nbytes + tc.dstStride) * tc.nsegments
+
+    // start from a clean destination, then apply the copy to the model
+    for (i <- dst until dstEnd)
+      model(i) = ((i * 7 + 3) & 0xff).toByte
+    writeBeats(dst, dstEnd)
+    for (seg <- 0 until tc.nsegments; i <- 0 until tc.nbytes if !tc.fault) {
+      val s = src + seg * (tc.nbytes + tc.srcStride) + i
+      val d = dst + seg * (tc.nbytes + tc.dstStride) + i
+      model(d) = model(s)
+    }
+
+    poke(c.io.segment_size, tc.nbytes)
+    poke(c.io.src_stride, tc.srcStride)
+    poke(c.io.dst_stride, tc.dstStride)
+    poke(c.io.nsegments, tc.nsegments)
+    poke(c.io.phys, if (tc.phys) 1 else 0)
+    poke(c.io.local_addr.addr, 0)
+    poke(c.io.local_addr.port, 0)
+    poke(c.io.remote_addr.addr, 0)
+    poke(c.io.remote_addr.port, 0)
+    poke(c.io.cmd.bits.src, src)
+    poke(c.io.cmd.bits.dst, dst)
+    poke(c.io.cmd.bits.direction, if (tc.put) 1 else 0)
+    poke(c.io.nacks, tc.nacks)
+    poke(c.io.max_retries, tc.nacks)
+    poke(c.io.backoff, if (tc.nacks > 0) 4 else 0)
+    poke(c.io.cmd.valid, 1)
+
+    // bytes_done still holds the last transfer's count until the
+    // transmitter takes the command and clears it. It then counts up
+    // across all the segments of the command.
+    val total_bytes = tc.nbytes * tc.nsegments
+    var started = false
+    var progress_ok = true
+    def checkProgress() {
+      val done = peek(c.io.bytes_done).toInt
+      val seg = done / tc.nbytes
+      val seg_done = done % tc.nbytes
+      val seg_dst = dst + seg * (tc.nbytes + tc.dstStride)
+      if (done == 0) {
+        started = true
+      } else if (started && (done > total_bytes ||
+                 (seg_done != 0 && (seg_dst + seg_done) % blockBytes != 0))) {
+        // part way through a segment, only whole destination blocks are done
+        println("bytes_done " + done + " after a block")
+        progress_ok = false
+      }
+    }
+
+    var cycles = 0
+    while (peek(c.io.cmd.ready) == 0) {
+      step(1)
+      cycles += 1
+    }
+    step(1)
+    cycles += 1
+    poke(c.io.cmd.valid, 0)
+
+    while (peek(c.io.busy) == 1 && cycles < timeout) {
+      checkProgress()
+      step(1)
+      cycles += 1
+    }
+
+    // the source faults for puts; for gets the receiver nacks the stream
+    val want_error = if (!tc.fault) 0 else if (tc.put) 1 else 2
+
+    if (cycles >= timeout) {
+      println("timed out after " + cycles + " cycles")
+      None
+    } else if (tc.fault) {
+      // whatever got written before the fault, start the next case clean
+      writeBeats(dst, dstEnd)
+      if (peek(c.io.error) != want_error) {
+        println("expected error " + want_error + ", got " + peek(c.io.error))
+        None
+      } else {
+        Some(cycles)
+      }
+    } else if (peek(c.io.error) != 0) {
+      println("transfer failed with error " + peek(c.io.error))
+      None
+    } else if (!progress_ok || peek(c.io.bytes_done) != total_bytes) {
+      println("wrong bytes_done")
+      None
+    } else if (!checkBeats(dst, dstEnd)) {
+      None
+    } else {
+      Some(cycles)
+    }
+  }
+
+  writeBeats(0, memBytes)
+
+  // cycles taken by each case, or None if it failed
+  val results = ArrayBuffer[Option[Int]]()
+
+  if (verbose)
+    println("dir  phys   bytes  src  dst  sstride dstride segs   cycles  B/cycle")
+  for (tc <- cases) {
+    val total = tc.nbytes * tc.nsegments
+    val result = run(tc)
+    result match {
+      case Some(cycles) =>
+        if (verbose)
+          println("%-4s %-5s %6d %4d %4d %8d %7d %4d %8d %8.2f".format(
+            if (tc.put) "put" else "get", tc.phys, tc.nbytes,
+            tc.srcOff, tc.dstOff, tc.srcStride, tc.dstStride,
+            tc.nsegments, cycles, total.toDouble / cycles))
+      case None =>
+        println("FAILED: " + tc)
+    }
+    results += result
+  }
+  ok = results.forall(_.isDefined)
+}
+
+// usage: DMATestHarnessMain ConfigClass memLatency memBeatInterval
+//                           netLatency [chisel args]
+object DMATestHarnessMain {
+  def main(args: Array[String]) {
+    val config = Class.forName(args(0)).newInstance.asInstanceOf[ChiselConfig]
+    val memLatency = args(1).toInt
+    val memBeatInterval = args(2).toInt
+    val netLatency = args(3).toInt
+    val params = Parameters.root(config.toInstance)
+
+    chiselMainTest(args.drop(4), () => Module(new DMATestHarness(
+        memLatency = memLatency,
+        memBeatInterval = memBeatInterval,
+        netLatency = netLatency))(params)) {
+      c => new DMATestHarnessTester(c)
+    }
+  }
+}
@@ -0,0 +1,131 @@
+package dma
+
+import Chisel._
+import uncore._
+
+object TraceSources {
+  val sender = UInt(0)
+  val tx     = UInt(1)
+  val rx     = UInt(2)
+  val txFill = UInt(3)
+}
+
+// For tx, txFill and rx events, code is the state the engine just entered.
+// The decoder in tests/dma-trace.c needs to know the order of the states.
+class TraceEvent extends Bundle {
+  val source = UInt(width = 8)
+  val code = UInt(width = 8)
+  val info = UInt(width = 8)
+  val xact_id = UInt(width = 8)
+}
+
+class TraceRecord extends Bundle {
+  val timestamp = UInt(width = 64)
+  val event = new TraceEvent
+}
+
+// Writes timestamped events into a ring buffer of records in physical
+// memory. Each record takes up one beat: the timestamp in the low 64 bits,
+// followed by source, code, info, xact_id, and the low 32 bits of the
+// record's sequence number. Setting size (the number of records, which must
+// be a power of two) to zero turns tracing off; records still queued then
+// are thrown away and counted as dropped, so software should wait for
+// pending to go low first. Each record is written with its own put, so
+// each source has a queue deep enough to absorb a burst of state changes.
+class DMATraceUnit(nSources: Int, queueDepth: Int = 16) extends DMAModule {
+  val io = new Bundle {
+    val events = Vec.fill(nSources) { Valid(new TraceEvent).flip }
+    val dmem = new ClientUncachedTileLinkIO
+    val base = UInt(INPUT, paddrBits)
+    val size = UInt(INPUT, paddrBits)
+    val head = UInt(OUTPUT, paddrBits)
+    val head_write = Valid(UInt(width = paddrBits)).flip
+    val dropped = UInt(OUTPUT, 32)
+    // records are queued or being written
+    val pending = Bool(OUTPUT)
+  }
+
+  require(tlDataBits >= 128)
+
+  private val recordOffset = log2Up(tlDataBytes)
+  private val tlBlockOffset = tlBeatAddrBits + tlByteAddrBits
+
+  val cycle = Reg(init = UInt(0, 64))
+  cycle := cycle + UInt(1)
+
+  val enabled = io.size != UInt(0)
+
+  val arb = Module(new RRArbiter(new TraceRecord, nSources))
+  val drops = Vec.fill(nSources) { Bool() }
+  val queued = Vec.fill(nSources) { Bool() }
+
+  for (i <- 0 until nSources) {
+    val queue = Module(new Queue(new TraceRecord, queueDepth))
+    queue.io.enq.valid := io.events(i).valid && enabled
+    queue.io.enq.bits.timestamp := cycle
+    queue.io.enq.bits.event := io.events(i).bits
+    arb.io.in(i) <> queue.io.deq
+    drops(i) := queue.io.enq.valid && !queue.io.enq.ready
+    queued(i) := queue.io.deq.valid
+  }
+
+  val (s_idle :: s_put :: s_grant :: Nil) = Enum(Bits(), 3)
+  val state = Reg(init = s_idle)
+
+  // records thrown away because tracing was turned off under them
+  val discard = (state === s_idle && arb.io.out.valid && !enabled) ||
+    (state === s_put && !enabled)
+
+  val dropped = Reg(init = UInt(0, 32))
+  dropped := dropped + PopCount(drops) + discard
+  io.dropped := dropped
+  io.pending := queued.toBits.orR || state != s_idle
+
+  val head = Reg(init = UInt(0, paddrBits))
+  val record = Reg(new TraceRecord)
+  val index = head & (io.size - UInt(1))
+  val addr = io.base + (index << UInt(recordOffset))
+  val record_data = Cat(head(31, 0),
+    record.event.xact_id, record.event.info,
+    record.event.code, record.event.source,
+    record.timestamp)
+
+  io.head := head
+
+  arb.io.out.ready := (state === s_idle)
+
+  io.dmem.acquire.valid := (state === s_put) && enabled
+  io.dmem.acquire.bits := Put(
+    client_xact_id = UInt(0),
+    addr_block = addr(paddrBits - 1, tlBlockOffset),
+    addr_beat = addr(tlBlockOffset - 1, tlByteAddrBits),
+    data = record_data)
+  io.dmem.grant.ready := (state === s_grant)
+
+  switch (state) {
+    is (s_idle) {
+      // while tracing is off, the queues are drained and discarded
+      when (arb.io.out.valid && enabled) {
+        record := arb.io.out.bits
+        state := s_put
+      }
+    }
+    is (s_put) {
+      when (!enabled) {
+        state := s_idle
+      } .elsewhen (io.dmem.acquire.ready) {
+        state := s_grant
+      }
+    }
+    is (s_grant) {
+      when (io.dmem.grant.valid) {
+        head := head + UInt(1)
+        state := s_idle
+      }
+    }
+  }
+
+  when (io.head_write.valid) {
+    head := io.head_write.bits
+  }
+}
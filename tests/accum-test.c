@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include "dma-ext.h"
+
+#define PORT 100
+#define N 64
+
+static int32_t dst32[N] __attribute__((aligned(64)));
+static int32_t src32[N] __attribute__((aligned(64)));
+static int64_t dst64[N] __attribute__((aligned(64)));
+static int64_t src64[N] __attribute__((aligned(64)));
+static float dstf[N] __attribute__((aligned(64)));
+static float srcf[N] __attribute__((aligned(64)));
+
+static int accum_put(struct dma_addr *addr, void *dst, void *src,
+		unsigned long len, int op, int type)
+{
+	dma_accum_put(addr, dst, src, len, op, type);
+	dma_fence();
+	return dma_send_error();
+}
+
+static int32_t expect32(int op, int32_t a, int32_t b)
+{
+	switch (op) {
+	case DMA_ACCUM_ADD:
+		return (int32_t) ((uint32_t) a + (uint32_t) b);
+	case DMA_ACCUM_MIN:
+		return a < b ? a : b;
+	case DMA_ACCUM_MAX:
+		return a < b ? b : a;
+	default:
+		return a ^ b;
+	}
+}
+
+static int64_t expect64(int op, int64_t a, int64_t b)
+{
+	switch (op) {
+	case DMA_ACCUM_ADD:
+		return (int64_t) ((uint64_t) a + (uint64_t) b);
+	case DMA_ACCUM_MIN:
+		return a < b ? a : b;
+	case DMA_ACCUM_MAX:
+		return a < b ? b : a;
+	default:
+		return a ^ b;
+	}
+}
+
+static int test_int32(struct dma_addr *addr, int op)
+{
+	int32_t old[N];
+	int i, err;
+
+	for (i = 0; i < N; i++) {
+		dst32[i] = old[i] = (int32_t) (i * 0x01234567u) ^ (op << 28);
+		src32[i] = 0x7ffffff0 - i * 0x00765432;
+	}
+
+	// start one element into the block and stop short of the end,
+	// so the first and last blocks are only partly combined
+	err = accum_put(addr, &dst32[1], &src32[1],
+			(N - 3) * sizeof(int32_t), op, DMA_ACCUM_INT32);
+	if (err)
+		return err;
+
+	for (i = 0; i < N; i++) {
+		int32_t want = (i < 1 || i >= N - 2) ? old[i] :
+			expect32(op, old[i], src32[i]);
+		if (dst32[i] != want)
+			return 0x8;
+	}
+
+	return 0;
+}
+
+static int test_int64(struct dma_addr *addr, int op)
+{
+	int64_t old[N];
+	int i, err;
+
+	for (i = 0; i < N; i++) {
+		dst64[i] = old[i] = (i - N / 2) * 0x0123456789abcdefL;
+		src64[i] = 0x7ffffffffffffff0L - i * 0x0076543210fedcbaL;
+	}
+
+	err = accum_put(addr, dst64, src64, N * sizeof(int64_t),
+			op, DMA_ACCUM_INT64);
+	if (err)
+		return err;
+
+	for (i = 0; i < N; i++) {
+		if (dst64[i] != expect64(op, old[i], src64[i]))
+			return 0x8;
+	}
+
+	return 0;
+}
+
+static int test_float(struct dma_addr *addr, int op)
+{
+	float old[N], want;
+	int i, err;
+
+	// all of these sums are exact
+	for (i = 0; i < N; i++) {
+		dstf[i] = old[i] = (i - N / 2) * 0.5f;
+		srcf[i] = (i % 7) * -1.25f;
+	}
+
+	err = accum_put(addr, dstf, srcf, N * sizeof(float),
+			op, DMA_ACCUM_FLOAT32);
+	if (err)
+		return err;
+
+	for (i = 0; i < N; i++) {
+		if (op == DMA_ACCUM_ADD)
+			want = old[i] + srcf[i];
+		else if (op == DMA_ACCUM_MIN)
+			want = old[i] < srcf[i] ? old[i] : srcf[i];
+		else
+			want = old[i] < srcf[i] ? srcf[i] : old[i];
+		if (dstf[i] != want)
+			return 0x8;
+	}
+
+	return 0;
+}
+
+/* malformed puts must fail without touching the destination */
+static int test_invalid(struct dma_addr *addr)
+{
+	int i, err;
+
+	for (i = 0; i < N; i++)
+		dst64[i] = src64[i] = i;
+
+	err = accum_put(addr, (uint8_t *) dst64 + 4, src64,
+			2 * sizeof(int64_t), DMA_ACCUM_ADD, DMA_ACCUM_INT64);
+	if (err != DMA_TX_INVALID)
+		return 0x1;
+	err = accum_put(addr, dst64, src64, 6, DMA_ACCUM_ADD, DMA_ACCUM_INT32);
+	if (err != DMA_TX_INVALID)
+		return 0x2;
+	err = accum_put(addr, dst64, src64, N * sizeof(int64_t),
+			DMA_ACCUM_ADD, 3);
+	if (err != DMA_TX_INVALID)
+		return 0x3;
+
+	for (i = 0; i < N; i++) {
+		if (dst64[i] != i)
+			return 0x8;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct dma_addr addr;
+	int op, err;
+
+	addr.addr = 0;
+	addr.port = PORT;
+	dma_bind_addr(&addr);
+
+	for (op = DMA_ACCUM_ADD; op <= DMA_ACCUM_XOR; op++) {
+		err = test_int32(&addr, op);
+		if (err)
+			return 0x100 | (op << 4) | err;
+		err = test_int64(&addr, op);
+		if (err)
+			return 0x200 | (op << 4) | err;
+	}
+
+	for (op = DMA_ACCUM_ADD; op <= DMA_ACCUM_MAX; op++) {
+		err = test_float(&addr, op);
+		if (err)
+			return 0x300 | (op << 4) | err;
+	}
+
+	err = test_invalid(&addr);
+	if (err)
+		return 0x500 | err;
+
+	// a plain put still overwrites
+	dst32[0] = 1;
+	src32[0] = 2;
+	dma_contig_put(&addr, dst32, src32, sizeof(int32_t));
+	dma_fence();
+	err = dma_send_error();
+	if (err)
+		return 0x400 | err;
+	if (dst32[0] != 2)
+		return 0x408;
+
+	return 0;
+}
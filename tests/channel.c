@@ -0,0 +1,127 @@
+#include <string.h>
+
+#include "channel.h"
+
+#define ALIGN 64
+#define ROUND_UP(x) (((x) + ALIGN - 1) & ~(unsigned long) (ALIGN - 1))
+
+/*
+ * Memory layout: the slots, their lengths, the tail, and the credit
+ * counter, each starting on its own cache line. Only the receiver's copy
+ * of the first three and the sender's copy of the credits are written
+ * remotely; the other copies hold the values about to be put.
+ */
+
+unsigned long dma_chan_size(unsigned long nslots, unsigned long slot_size)
+{
+	return ROUND_UP(nslots * slot_size) +
+		ROUND_UP(nslots * sizeof(uint64_t)) + 2 * ALIGN;
+}
+
+void dma_chan_init(struct dma_channel *ch, void *mem, unsigned long nslots,
+		unsigned long slot_size, struct dma_addr *peer)
+{
+	uint8_t *p = mem;
+
+	memset(mem, 0, dma_chan_size(nslots, slot_size));
+
+	ch->peer = *peer;
+	ch->ring = p;
+	p += ROUND_UP(nslots * slot_size);
+	ch->lens = (volatile uint64_t *) p;
+	p += ROUND_UP(nslots * sizeof(uint64_t));
+	ch->tail = (volatile uint64_t *) p;
+	ch->credits = (volatile uint64_t *) (p + ALIGN);
+
+	ch->nslots = nslots;
+	ch->slot_size = slot_size;
+	ch->sent = 0;
+	ch->head = 0;
+	ch->released = 0;
+	ch->credited = 0;
+}
+
+int dma_chan_send(struct dma_channel *ch, void *buf, unsigned long len)
+{
+	unsigned long slot = ch->sent % ch->nslots;
+	uint64_t *len_ptr = (uint64_t *) &ch->lens[slot];
+	unsigned long gap;
+	int err;
+
+	if (len > ch->slot_size)
+		return -1;
+
+	while (ch->sent - *ch->credits >= ch->nslots);
+
+	if (len > 0) {
+		dma_contig_put(&ch->peer, ch->ring + slot * ch->slot_size,
+				buf, len);
+		dma_fence();
+		err = dma_send_error();
+		if (err)
+			return err;
+	}
+
+	// the fence above waited for the payload to be acknowledged,
+	// so the receiver cannot see the new tail before the data
+	ch->sent++;
+	*len_ptr = len;
+	*ch->tail = ch->sent;
+
+	// the length and the tail go in one put of two words
+	gap = (uint8_t *) ch->tail - (uint8_t *) len_ptr - sizeof(uint64_t);
+	dma_put(&ch->peer, len_ptr, len_ptr, sizeof(uint64_t), gap, gap, 2);
+	dma_fence();
+
+	return dma_send_error();
+}
+
+void *dma_chan_poll(struct dma_channel *ch, unsigned long *len)
+{
+	unsigned long slot;
+
+	if (*ch->tail == ch->head)
+		return NULL;
+
+	// don't read the message before the tail
+	dma_fence();
+
+	slot = ch->head % ch->nslots;
+	*len = ch->lens[slot];
+	ch->head++;
+
+	return ch->ring + slot * ch->slot_size;
+}
+
+void *dma_chan_recv(struct dma_channel *ch, unsigned long *len)
+{
+	void *msg;
+
+	while ((msg = dma_chan_poll(ch, len)) == NULL);
+
+	return msg;
+}
+
+/*
+ * Credits go back a quarter of the ring at a time. A sender only waits
+ * when the whole ring is outstanding, and releasing that many messages
+ * always crosses a batch.
+ */
+int dma_chan_release(struct dma_channel *ch)
+{
+	unsigned long batch = ch->nslots / 4;
+
+	ch->released++;
+
+	if (ch->released - ch->credited < batch)
+		return 0;
+
+	*ch->credits = ch->released;
+	ch->credited = ch->released;
+
+	dma_contig_put(&ch->peer, (void *) ch->credits,
+			(void *) ch->credits, sizeof(uint64_t));
+	dma_fence();
+
+	return dma_send_error();
+}
@@ -0,0 +1,62 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+
+#include "dma-ext.h"
+
+/*
+ * One-way message channel between two processes. Messages are put straight
+ * into a ring of fixed-size slots in the receiver's memory, followed by a
+ * put that updates the receiver's copy of the tail. The receiver reads each
+ * message in place and returns the slots it is done with as credits, which
+ * it puts into the sender's copy of the credit counter.
+ *
+ * Both ends pass the same memory, at the same virtual address in each
+ * process (e.g. allocated before forking), and both must have called
+ * dma_chan_init before either end uses the channel.
+ */
+struct dma_channel {
+	struct dma_addr peer;
+	uint8_t *ring;
+	volatile uint64_t *lens;
+	volatile uint64_t *tail;
+	volatile uint64_t *credits;
+	unsigned long nslots;
+	unsigned long slot_size;
+	/* sender: messages sent */
+	uint64_t sent;
+	/* receiver: messages received, released, and credited back */
+	uint64_t head;
+	uint64_t released;
+	uint64_t credited;
+};
+
+/* bytes of memory needed for a channel */
+unsigned long dma_chan_size(unsigned long nslots, unsigned long slot_size);
+
+/*
+ * Set up one end of the channel in mem, which this clears.
+ * peer is the address of the process at the other end.
+ */
+void dma_chan_init(struct dma_channel *ch, void *mem, unsigned long nslots,
+		unsigned long slot_size, struct dma_addr *peer);
+
+/*
+ * Send len bytes from buf, waiting for a free slot if there is none.
+ * Returns 0, the DMA error code, or -1 if len is larger than a slot.
+ */
+int dma_chan_send(struct dma_channel *ch, void *buf, unsigned long len);
+
+/*
+ * Return the next message without copying it, or NULL if there is none yet.
+ * The message stays valid until it is released.
+ */
+void *dma_chan_poll(struct dma_channel *ch, unsigned long *len);
+/* like dma_chan_poll, but wait for a message */
+void *dma_chan_recv(struct dma_channel *ch, unsigned long *len);
+
+/* Hand the oldest received message's slot back to the sender */
+int dma_chan_release(struct dma_channel *ch);
+
+#endif
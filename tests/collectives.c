@@ -0,0 +1,433 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "collectives.h"
+#include "dma-ext.h"
+
+#define BLOCK(buf, i, nbytes) ((uint8_t *) (buf) + (unsigned long) (i) * (nbytes))
+
+#define TRY(expr) do { \
+	int __err = (expr); \
+	if (__err) \
+		return __err; \
+} while (0)
+
+/*
+ * A failed put must not skip the barriers after it, or every other process
+ * waits in them forever. So remember the first error, send nothing more and
+ * return the error once the collective's barriers are done.
+ */
+#define TRY_PUT(err, expr) do { \
+	if (!(err)) \
+		(err) = (expr); \
+} while (0)
+
+static inline int is_pow2(int n)
+{
+	return (n & (n - 1)) == 0;
+}
+
+static inline int mod(int a, int n)
+{
+	return ((a % n) + n) % n;
+}
+
+/* a put from this process to rank, which has finished when this returns */
+static int comm_put(struct dma_comm *comm, int rank, void *dst, void *src,
+		unsigned long segsize, unsigned long src_stride,
+		unsigned long dst_stride, unsigned long nsegments)
+{
+	struct dma_addr addr;
+
+	if (segsize == 0 || nsegments == 0)
+		return 0;
+
+	addr.addr = 0;
+	addr.port = comm->base_port + rank;
+
+	dma_put(&addr, dst, src, segsize, src_stride, dst_stride, nsegments);
+	dma_fence();
+	return dma_send_error();
+}
+
+int dma_comm_init(struct dma_comm *comm, const char *name, int size,
+		unsigned short base_port, unsigned long work_size)
+{
+	if (barrier_init(&comm->barrier, name, size))
+		return -1;
+
+	comm->work = NULL;
+	if (work_size > 0) {
+		comm->work = malloc(work_size);
+		if (comm->work == NULL)
+			return -1;
+	}
+
+	comm->work_size = work_size;
+	comm->rank = 0;
+	comm->size = size;
+	comm->base_port = base_port;
+
+	return 0;
+}
+
+void dma_comm_join(struct dma_comm *comm, int rank)
+{
+	struct dma_addr addr;
+
+	comm->rank = rank;
+
+	addr.addr = 0;
+	addr.port = comm->base_port + rank;
+	dma_bind_addr(&addr);
+
+	// make the scratch pages our own before anyone writes to them
+	if (comm->work)
+		memset(comm->work, 0, comm->work_size);
+}
+
+int dma_comm_close(struct dma_comm *comm)
+{
+	free(comm->work);
+	comm->work = NULL;
+
+	if (barrier_close(&comm->barrier))
+		return -1;
+
+	return 0;
+}
+
+int dma_coll_barrier(struct dma_comm *comm)
+{
+	if (barrier_wait(&comm->barrier))
+		return -1;
+	return 0;
+}
+
+/*
+ * Every collective starts with a barrier, so that nobody writes into a
+ * buffer its owner may still be using, and only returns once everything
+ * it receives has arrived.
+ */
+
+static int broadcast_binomial(struct dma_comm *comm, void *buf,
+		unsigned long nbytes, int root)
+{
+	int vrank = mod(comm->rank - root, comm->size);
+	int mask, err = 0;
+
+	for (mask = 1; mask < comm->size; mask <<= 1) {
+		if (vrank < mask && vrank + mask < comm->size)
+			TRY_PUT(err, comm_put(comm,
+					mod(vrank + mask + root, comm->size),
+					buf, buf, nbytes, 0, 0, 1));
+		TRY(dma_coll_barrier(comm));
+	}
+
+	return err;
+}
+
+static inline unsigned long chunk_len(unsigned long nbytes,
+		unsigned long chunk, int i)
+{
+	unsigned long start = i * chunk;
+
+	if (start >= nbytes)
+		return 0;
+	if (nbytes - start < chunk)
+		return nbytes - start;
+	return chunk;
+}
+
+/*
+ * Long messages: the root scatters one chunk to each process, and a ring
+ * allgather then circulates the chunks, so the root sends each byte once.
+ */
+static int broadcast_scatter_allgather(struct dma_comm *comm, void *buf,
+		unsigned long nbytes, int root)
+{
+	int p = comm->size, rank = comm->rank;
+	unsigned long chunk = (nbytes + p - 1) / p;
+	int i, s, err = 0;
+
+	if (rank == root) {
+		for (i = 0; i < p; i++) {
+			if (i == root)
+				continue;
+			TRY_PUT(err, comm_put(comm, i, BLOCK(buf, i, chunk),
+					BLOCK(buf, i, chunk),
+					chunk_len(nbytes, chunk, i), 0, 0, 1));
+		}
+	}
+	TRY(dma_coll_barrier(comm));
+
+	for (s = 0; s < p - 1; s++) {
+		i = mod(rank - s, p);
+		TRY_PUT(err, comm_put(comm, mod(rank + 1, p),
+				BLOCK(buf, i, chunk), BLOCK(buf, i, chunk),
+				chunk_len(nbytes, chunk, i), 0, 0, 1));
+		TRY(dma_coll_barrier(comm));
+	}
+
+	return err;
+}
+
+int dma_broadcast(struct dma_comm *comm, void *buf,
+		unsigned long nbytes, int root)
+{
+	TRY(dma_coll_barrier(comm));
+
+	if (nbytes >= DMA_COLL_LONG_MSG && comm->size > 2)
+		return broadcast_scatter_allgather(comm, buf, nbytes, root);
+	return broadcast_binomial(comm, buf, nbytes, root);
+}
+
+/*
+ * Every block of a scatter or gather crosses the root's link once whatever
+ * the algorithm, so the root exchanges blocks with each process directly.
+ */
+
+int dma_scatter(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes, int root)
+{
+	int i, peer, err = 0;
+
+	TRY(dma_coll_barrier(comm));
+
+	if (comm->rank == root) {
+		for (i = 1; i < comm->size; i++) {
+			peer = mod(root + i, comm->size);
+			TRY_PUT(err, comm_put(comm, peer, dst,
+					BLOCK(src, peer, nbytes),
+					nbytes, 0, 0, 1));
+		}
+		memcpy(dst, BLOCK(src, root, nbytes), nbytes);
+	}
+
+	TRY(dma_coll_barrier(comm));
+	return err;
+}
+
+int dma_gather(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes, int root)
+{
+	int err = 0;
+
+	TRY(dma_coll_barrier(comm));
+
+	if (comm->rank == root)
+		memcpy(BLOCK(dst, root, nbytes), src, nbytes);
+	else
+		TRY_PUT(err, comm_put(comm, root,
+				BLOCK(dst, comm->rank, nbytes), src,
+				nbytes, 0, 0, 1));
+
+	TRY(dma_coll_barrier(comm));
+	return err;
+}
+
+int dma_allgather(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes)
+{
+	int p = comm->size, rank = comm->rank;
+	int mask, first, s, i, err = 0;
+
+	TRY(dma_coll_barrier(comm));
+
+	if (BLOCK(dst, rank, nbytes) != src)
+		memcpy(BLOCK(dst, rank, nbytes), src, nbytes);
+
+	if (is_pow2(p) && nbytes < DMA_COLL_SHORT_MSG) {
+		// recursive doubling: swap everything gathered so far
+		for (mask = 1; mask < p; mask <<= 1) {
+			first = rank & ~(mask - 1);
+			TRY_PUT(err, comm_put(comm, rank ^ mask,
+					BLOCK(dst, first, nbytes),
+					BLOCK(dst, first, nbytes),
+					mask * nbytes, 0, 0, 1));
+			TRY(dma_coll_barrier(comm));
+		}
+	} else {
+		// ring: pass on the block received in the previous step
+		for (s = 0; s < p - 1; s++) {
+			i = mod(rank - s, p);
+			TRY_PUT(err, comm_put(comm, mod(rank + 1, p),
+					BLOCK(dst, i, nbytes),
+					BLOCK(dst, i, nbytes),
+					nbytes, 0, 0, 1));
+			TRY(dma_coll_barrier(comm));
+		}
+	}
+
+	return err;
+}
+
+static int alltoall_pairwise(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes)
+{
+	int p = comm->size, rank = comm->rank;
+	int s, peer, err = 0;
+
+	memcpy(BLOCK(dst, rank, nbytes), BLOCK(src, rank, nbytes), nbytes);
+
+	for (s = 1; s < p; s++) {
+		peer = mod(rank + s, p);
+		TRY_PUT(err, comm_put(comm, peer, BLOCK(dst, rank, nbytes),
+				BLOCK(src, peer, nbytes), nbytes, 0, 0, 1));
+	}
+
+	TRY(dma_coll_barrier(comm));
+	return err;
+}
+
+/*
+ * Bruck's algorithm, for a power of two number of processes. After
+ * rotating the blocks, round k forwards every block whose index has bit k
+ * set to process rank + k. Those blocks form runs of k blocks spaced k
+ * blocks apart, so each round is a single strided put straight out of and
+ * into the block array. The two receive areas alternate between rounds so
+ * that a put never overwrites blocks the receiver has not copied out yet.
+ */
+static int alltoall_bruck(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes)
+{
+	int p = comm->size, rank = comm->rank;
+	uint8_t *tmp = comm->work;
+	uint8_t *recv[2] = { tmp + p * nbytes, tmp + 2 * p * nbytes };
+	unsigned long run;
+	int i, k, round = 0, err = 0;
+
+	for (i = 0; i < p; i++)
+		memcpy(BLOCK(tmp, i, nbytes),
+			BLOCK(src, mod(rank + i, p), nbytes), nbytes);
+
+	for (k = 1; k < p; k <<= 1, round++) {
+		uint8_t *in = recv[round & 1];
+
+		run = k * nbytes;
+		TRY_PUT(err, comm_put(comm, mod(rank + k, p),
+				BLOCK(in, k, nbytes), BLOCK(tmp, k, nbytes),
+				run, run, run, p / (2 * k)));
+		TRY(dma_coll_barrier(comm));
+
+		for (i = k; i < p; i += 2 * k)
+			memcpy(BLOCK(tmp, i, nbytes), BLOCK(in, i, nbytes), run);
+	}
+
+	// block i now comes from process rank - i
+	for (i = 0; i < p; i++)
+		memcpy(BLOCK(dst, mod(rank - i, p), nbytes),
+			BLOCK(tmp, i, nbytes), nbytes);
+
+	return err;
+}
+
+int dma_alltoall(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes)
+{
+	int p = comm->size;
+
+	TRY(dma_coll_barrier(comm));
+
+	if (p > 2 && is_pow2(p) && nbytes < DMA_COLL_SHORT_MSG &&
+			comm->work_size >= 3 * p * nbytes)
+		return alltoall_bruck(comm, dst, src, nbytes);
+	return alltoall_pairwise(comm, dst, src, nbytes);
+}
+
+static void reduce(int64_t *acc, int64_t *in, unsigned long count,
+		enum dma_reduce_op op)
+{
+	unsigned long i;
+
+	switch (op) {
+	case DMA_REDUCE_SUM:
+		for (i = 0; i < count; i++)
+			acc[i] += in[i];
+		break;
+	case DMA_REDUCE_MIN:
+		for (i = 0; i < count; i++)
+			if (in[i] < acc[i])
+				acc[i] = in[i];
+		break;
+	case DMA_REDUCE_MAX:
+		for (i = 0; i < count; i++)
+			if (in[i] > acc[i])
+				acc[i] = in[i];
+		break;
+	}
+}
+
+/*
+ * Ring: in step s each process sends its partial result for block
+ * rank - s - 1 to the next process and folds the partial result for block
+ * rank - s - 2 from the previous one into its own.
+ */
+static int reduce_scatter_ring(struct dma_comm *comm, int64_t *dst,
+		int64_t *src, unsigned long count, enum dma_reduce_op op)
+{
+	int p = comm->size, rank = comm->rank;
+	int64_t *work = comm->work;
+	int64_t *in[2] = { work, work + count };
+	unsigned long block = count * sizeof(int64_t);
+	int s, err = 0;
+
+	for (s = 0; s < p - 1; s++) {
+		TRY_PUT(err, comm_put(comm, mod(rank + 1, p), in[s & 1],
+				src + mod(rank - s - 1, p) * count,
+				block, 0, 0, 1));
+		TRY(dma_coll_barrier(comm));
+		reduce(src + mod(rank - s - 2, p) * count, in[s & 1],
+				count, op);
+	}
+
+	memcpy(dst, src + rank * count, block);
+	return err;
+}
+
+/*
+ * Recursive halving, for a power of two number of processes: each round
+ * hands the half of the remaining blocks that the partner keeps over to it
+ * and folds the partner's contribution into the half kept here.
+ */
+static int reduce_scatter_halving(struct dma_comm *comm, int64_t *dst,
+		int64_t *src, unsigned long count, enum dma_reduce_op op)
+{
+	int p = comm->size, rank = comm->rank;
+	int64_t *work = comm->work;
+	int64_t *in[2] = { work, work + (p / 2) * count };
+	unsigned long block = count * sizeof(int64_t);
+	int mask, keep, give, lo = 0, round = 0, err = 0;
+
+	for (mask = p / 2; mask > 0; mask >>= 1, round++) {
+		keep = (rank & mask) ? lo + mask : lo;
+		give = (rank & mask) ? lo : lo + mask;
+
+		TRY_PUT(err, comm_put(comm, rank ^ mask, in[round & 1],
+				src + give * count, mask * block, 0, 0, 1));
+		TRY(dma_coll_barrier(comm));
+		reduce(src + keep * count, in[round & 1], mask * count, op);
+
+		lo = keep;
+	}
+
+	memcpy(dst, src + rank * count, block);
+	return err;
+}
+
+int dma_reduce_scatter(struct dma_comm *comm, int64_t *dst, int64_t *src,
+		unsigned long count, enum dma_reduce_op op)
+{
+	unsigned long block = count * sizeof(int64_t);
+	int p = comm->size;
+
+	if (comm->work_size < 2 * block)
+		return -1;
+
+	TRY(dma_coll_barrier(comm));
+
+	if (is_pow2(p) && block < DMA_COLL_SHORT_MSG &&
+			comm->work_size >= p * block)
+		return reduce_scatter_halving(comm, dst, src, count, op);
+	return reduce_scatter_ring(comm, dst, src, count, op);
+}
@@ -0,0 +1,82 @@
+#ifndef COLLECTIVES_H
+#define COLLECTIVES_H
+
+#include <stdint.h>
+
+#include "barrier.h"
+
+/*
+ * Collective operations between size processes, process i being bound to
+ * port base_port + i. Buffers passed to a collective must be at the same
+ * virtual address in every process, e.g. allocated before forking, and
+ * each process must write to its copy after forking so that the pages
+ * the DMA engine writes into are its own.
+ *
+ * Each call returns 0 on success, the DMA error code if one of its puts
+ * failed, or -1 on any other failure.
+ */
+
+/* below this many bytes per block, use the latency-bound algorithms */
+#define DMA_COLL_SHORT_MSG 2048
+/* from this many bytes on, broadcast as a scatter followed by an allgather */
+#define DMA_COLL_LONG_MSG 16384
+
+struct dma_comm {
+	struct barrier barrier;
+	int rank;
+	int size;
+	unsigned short base_port;
+	/* scratch space at the same address in every process */
+	void *work;
+	unsigned long work_size;
+};
+
+enum dma_reduce_op {
+	DMA_REDUCE_SUM,
+	DMA_REDUCE_MIN,
+	DMA_REDUCE_MAX,
+};
+
+/*
+ * Call once before forking the processes. work_size is the scratch space
+ * the collectives may use: alltoall needs 3 * size * nbytes for its short
+ * message algorithm, and reduce_scatter needs 2 * count * 8 bytes, or
+ * size * count * 8 for its short message algorithm.
+ */
+int dma_comm_init(struct dma_comm *comm, const char *name, int size,
+		unsigned short base_port, unsigned long work_size);
+/* Call in each process after forking to bind it to its rank */
+void dma_comm_join(struct dma_comm *comm, int rank);
+int dma_comm_close(struct dma_comm *comm);
+
+int dma_coll_barrier(struct dma_comm *comm);
+
+/* copy nbytes at buf in root to buf in every other process */
+int dma_broadcast(struct dma_comm *comm, void *buf,
+		unsigned long nbytes, int root);
+
+/* block i of nbytes at src in root goes to dst in process i */
+int dma_scatter(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes, int root);
+
+/* nbytes at src in process i goes to block i of dst in root */
+int dma_gather(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes, int root);
+
+/* nbytes at src in process i goes to block i of dst in every process */
+int dma_allgather(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes);
+
+/* block j of src in process i goes to block i of dst in process j */
+int dma_alltoall(struct dma_comm *comm, void *dst, void *src,
+		unsigned long nbytes);
+
+/*
+ * Reduce the size blocks of count elements at src element-wise across all
+ * processes, leaving the result for block i at dst in process i.
+ * src is used as scratch space and is overwritten.
+ */
+int dma_reduce_scatter(struct dma_comm *comm, int64_t *dst, int64_t *src,
+		unsigned long count, enum dma_reduce_op op);
+
+#endif
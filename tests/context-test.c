@@ -0,0 +1,91 @@
+#include "dma-ext.h"
+
+#define PORT 100
+#define NBYTES 256
+
+static char src[NBYTES] __attribute__((aligned(64)));
+static char dst[NBYTES] __attribute__((aligned(64)));
+
+static void enter(unsigned long asid, unsigned long retries)
+{
+	struct dma_addr addr;
+
+	addr.addr = 0;
+	addr.port = PORT;
+
+	dma_select_context(asid);
+	write_csr(0x80B, 1);
+	dma_bind_addr(&addr);
+	dma_set_retry(retries, 0);
+}
+
+int main(void)
+{
+	struct dma_addr addr, local;
+	int i, err;
+
+	for (i = 0; i < NBYTES; i++) {
+		src[i] = i;
+		dst[i] = 0;
+	}
+
+	addr.addr = 0;
+	addr.port = PORT;
+
+	enter(1, 1);
+	enter(2, 2);
+	if (dma_context_asid() != 2)
+		return 0x10;
+	if (read_csr(0x80C) != 2)
+		return 0x11;
+
+	// leave an error behind in context 2
+	addr.port = PORT + 2;
+	dma_contig_put(&addr, dst, src, NBYTES);
+	dma_fence();
+	err = dma_send_error();
+	if (err != DMA_TX_NOROUTE)
+		return 0x20 | err;
+	addr.port = PORT;
+
+	dma_select_context(1);
+	if (dma_context_asid() != 1)
+		return 0x30;
+	if (read_csr(0x80C) != 1)
+		return 0x31;
+	if (dma_send_error())
+		return 0x32;
+
+	dma_contig_put(&addr, dst, src, NBYTES);
+	dma_fence();
+	err = dma_send_error();
+	if (err)
+		return 0x40 | err;
+	for (i = 0; i < NBYTES; i++) {
+		if (dst[i] != src[i])
+			return 0x48;
+	}
+
+	dma_select_context(2);
+	if (dma_send_error() != DMA_TX_NOROUTE)
+		return 0x50;
+
+	// 3 takes the last free context and 4 the oldest, that of ASID 0
+	enter(3, 3);
+	enter(4, 4);
+	dma_select_context(1);
+	if (read_csr(0x80C) != 1)
+		return 0x60;
+	dma_select_context(0);
+	dma_read_local_addr(&local);
+	if (local.port != 0 || read_csr(0x80C) != 0)
+		return 0x61;
+
+	// a released context comes back fresh
+	dma_release_context(2);
+	dma_select_context(2);
+	if (read_csr(0x80C) != 0 || dma_send_error())
+		return 0x70;
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "dma-alloc.h"
+
+#define MIN_SHIFT 6
+#define PAGE_SHIFT 12
+#define HUGE_SHIFT 21
+#define MAX_SHIFT 40
+#define NCLASSES (MAX_SHIFT - MIN_SHIFT + 1)
+#define NO_CLASS 0xff
+
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define HUGE_SIZE (1UL << HUGE_SHIFT)
+#define ROUND_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+struct free_chunk {
+	struct free_chunk *next;
+};
+
+static struct {
+	uint8_t *base;
+	unsigned long size;
+	unsigned long used;
+	int huge;
+	int locked;
+	/* size class of the chunks in each page, or of the chunk starting there */
+	uint8_t *page_class;
+	struct free_chunk *free[NCLASSES];
+} arena;
+
+static void *map(void *addr, unsigned long size, int huge)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *base;
+
+	if (huge)
+		flags |= MAP_HUGETLB | MAP_POPULATE;
+
+	base = mmap(addr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if (addr && base != addr) {
+		munmap(base, size);
+		return NULL;
+	}
+
+	return base;
+}
+
+int dma_arena_init(void *addr, unsigned long size)
+{
+	unsigned long npages;
+	uint8_t *base;
+	unsigned long off;
+	int huge = 1, locked = 1;
+
+	if (arena.base)
+		return -1;
+
+	size = ROUND_UP(size, HUGE_SIZE);
+
+	base = map(addr, size, 1);
+	if (base == NULL) {
+		// no huge pages reserved, so ask for transparent ones instead
+		huge = 0;
+		base = map(addr, size, 0);
+		if (base == NULL)
+			return -1;
+#ifdef MADV_HUGEPAGE
+		madvise(base, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	// this also faults in every page
+	if (mlock(base, size)) {
+		// over RLIMIT_MEMLOCK, which is small for ordinary users, so
+		// make do with pages that are present now but may be swapped
+		fprintf(stderr, "dma_arena_init: cannot lock the arena, "
+				"so transfers may page fault\n");
+		locked = 0;
+		if (!huge) {
+			for (off = 0; off < size; off += PAGE_SIZE)
+				base[off] = 0;
+		}
+	}
+
+	memset(&arena, 0, sizeof(arena));
+	arena.base = base;
+	arena.size = size;
+	arena.huge = huge;
+	arena.locked = locked;
+
+	npages = size >> PAGE_SHIFT;
+	arena.page_class = base;
+	memset(arena.page_class, NO_CLASS, npages);
+	arena.used = ROUND_UP(npages, PAGE_SIZE);
+
+	return 0;
+}
+
+int dma_arena_destroy(void)
+{
+	int ret;
+
+	if (!arena.base)
+		return -1;
+
+	ret = munmap(arena.base, arena.size);
+	memset(&arena, 0, sizeof(arena));
+
+	return ret;
+}
+
+int dma_arena_huge(void)
+{
+	return arena.huge;
+}
+
+int dma_arena_locked(void)
+{
+	return arena.locked;
+}
+
+static uint8_t *bump(unsigned long size, unsigned long align)
+{
+	unsigned long off = ROUND_UP(arena.used, align);
+
+	if (off > arena.size || arena.size - off < size)
+		return NULL;
+
+	arena.used = off + size;
+	return arena.base + off;
+}
+
+static inline void set_class(uint8_t *p, int class)
+{
+	arena.page_class[(p - arena.base) >> PAGE_SHIFT] = class;
+}
+
+void *dma_alloc(unsigned long size)
+{
+	struct free_chunk *chunk;
+	unsigned long chunk_size, off;
+	uint8_t *p;
+	int shift = MIN_SHIFT, class;
+
+	if (!arena.base || size == 0)
+		return NULL;
+
+	while ((1UL << shift) < size) {
+		if (++shift > MAX_SHIFT)
+			return NULL;
+	}
+	class = shift - MIN_SHIFT;
+	chunk_size = 1UL << shift;
+
+	chunk = arena.free[class];
+	if (chunk) {
+		arena.free[class] = chunk->next;
+		return chunk;
+	}
+
+	if (shift < PAGE_SHIFT) {
+		// split a fresh page into chunks of this size
+		p = bump(PAGE_SIZE, PAGE_SIZE);
+		if (!p)
+			return NULL;
+		set_class(p, class);
+
+		for (off = PAGE_SIZE - chunk_size; off > 0; off -= chunk_size) {
+			chunk = (struct free_chunk *) (p + off);
+			chunk->next = arena.free[class];
+			arena.free[class] = chunk;
+		}
+		return p;
+	}
+
+	p = bump(chunk_size, shift < HUGE_SHIFT ? chunk_size : HUGE_SIZE);
+	if (!p)
+		return NULL;
+	set_class(p, class);
+
+	return p;
+}
+
+void dma_free(void *ptr)
+{
+	struct free_chunk *chunk = ptr;
+	int class;
+
+	if (!ptr)
+		return;
+
+	class = arena.page_class[((uint8_t *) ptr - arena.base) >> PAGE_SHIFT];
+	chunk->next = arena.free[class];
+	arena.free[class] = chunk;
+}
@@ -0,0 +1,43 @@
+#ifndef DMA_ALLOC_H
+#define DMA_ALLOC_H
+
+/*
+ * Allocator for DMA buffers. All buffers come out of one arena that is
+ * reserved up front, backed by huge pages where the kernel has them, and
+ * locked in memory where RLIMIT_MEMLOCK allows, so the engine needs few
+ * translations and rarely finds a page missing. Allocation and freeing
+ * never make a system call.
+ *
+ * Buffers are rounded up to a power of two of at least one cache block
+ * and aligned to their size, up to a huge page. A buffer smaller than a
+ * page never crosses a page boundary.
+ *
+ * The same sequence of allocations gives the same addresses, so processes
+ * that each set up an arena at the same address after forking can name
+ * each other's buffers. Not thread-safe.
+ */
+
+/* an address that is normally free in a 64-bit Linux process */
+#define DMA_ARENA_ADDR ((void *) 0x2000000000UL)
+
+/*
+ * Reserve size bytes (rounded up to a huge page) at addr, or anywhere if
+ * addr is NULL. Returns 0 on success and -1 on failure.
+ */
+int dma_arena_init(void *addr, unsigned long size);
+int dma_arena_destroy(void);
+
+/* whether the arena got huge pages */
+int dma_arena_huge(void);
+
+/*
+ * Whether the arena is locked in memory. If not, it was still faulted in
+ * up front, but the kernel may swap pages out, and a transfer that finds
+ * one missing fails with a page fault.
+ */
+int dma_arena_locked(void);
+
+void *dma_alloc(unsigned long size);
+void dma_free(void *ptr);
+
+#endif
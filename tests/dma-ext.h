@@ -9,6 +9,7 @@
 #define DMA_TX_PAGEFAULT 1
 #define DMA_TX_NACK 2
 #define DMA_TX_NOROUTE 3
+#define DMA_TX_INVALID 4
 
 struct dma_addr {
 	unsigned long addr;
@@ -27,6 +28,8 @@ static inline void setup_dma(struct dma_addr *remote_addr,
 	write_csr(0x803, nsegments);
 	write_csr(0x806, remote_addr->addr);
 	write_csr(0x807, remote_addr->port);
+	write_csr(0x812, 0);
+	write_csr(0x821, 0);
 }
 
 static inline void dma_put(
@@ -63,6 +66,62 @@ static inline void dma_contig_put(struct dma_addr *remote_addr,
 	dma_put(remote_addr, dst, src, len, 0, 0, 1);
 }
 
+/*
+ * Put a tile of rows x cols elements so that it arrives transposed.
+ * src_pitch and dst_pitch are the distances in bytes between
+ * consecutive rows of the source and destination matrices.
+ * The element size must be 1, 2, 4 or 8; this returns -1 without sending
+ * anything for any other size. The addresses and pitches must be multiples
+ * of it, or nothing is sent and the put fails with DMA_TX_INVALID.
+ */
+static inline int dma_transpose_put(
+		struct dma_addr *remote_addr, void *dst, void *src,
+		unsigned long elem_size, unsigned long rows,
+		unsigned long cols, unsigned long src_pitch,
+		unsigned long dst_pitch)
+{
+	unsigned long segsize = rows * elem_size;
+
+	setup_dma(remote_addr, segsize, src_pitch,
+			dst_pitch - segsize, cols);
+	write_csr(0x812, elem_size);
+	if (read_csr(0x812) != elem_size)
+		return -1;
+
+	asm volatile ("fence");
+	asm volatile ("custom0 0, %[dst], %[src], 0" : :
+			[src] "r" (src), [dst] "r" (dst));
+	return 0;
+}
+
+#define DMA_ACCUM_ADD 0
+#define DMA_ACCUM_MIN 1
+#define DMA_ACCUM_MAX 2
+#define DMA_ACCUM_XOR 3
+
+#define DMA_ACCUM_INT32 0
+#define DMA_ACCUM_INT64 1
+#define DMA_ACCUM_FLOAT32 2
+
+/*
+ * Put len bytes, combining each element with the one already at the
+ * destination (dst[i] = op(dst[i], src[i])) instead of overwriting it.
+ * dst and len must be multiples of the element size. Float sums round
+ * to nearest even; min and max ignore a NaN operand. If dst or len is
+ * misaligned or type is not one of the above, nothing is sent and the
+ * put fails with DMA_TX_INVALID.
+ */
+static inline void dma_accum_put(struct dma_addr *remote_addr,
+		void *dst, void *src, unsigned long len, int op, int type)
+{
+	setup_dma(remote_addr, len, 0, 0, 1);
+	write_csr(0x821, 0x10 | (type << 2) | op);
+
+	asm volatile ("fence");
+	asm volatile ("custom0 0, %[dst], %[src], 0" : :
+			[src] "r" (src), [dst] "r" (dst));
+}
+
 static inline void dma_get(struct dma_addr *remote_addr, void *dst, void *src,
 		unsigned long segsize, unsigned long src_stride,
 		unsigned long dst_stride, unsigned long nsegments)
@@ -103,11 +162,189 @@ static inline void dma_bind_addr(struct dma_addr *addr)
 	write_csr(0x805, addr->port);
 }
 
+static inline void dma_read_local_addr(struct dma_addr *addr)
+{
+	addr->addr = read_csr(0x804);
+	addr->port = read_csr(0x805);
+}
+
 static inline int dma_send_error(void)
 {
 	return read_csr(0x80A);
 }
 
+/*
+ * Retry nacked blocks up to `retries` times, waiting
+ * backoff << attempt cycles before each retry.
+ */
+static inline void dma_set_retry(unsigned long retries, unsigned long backoff)
+{
+	write_csr(0x80C, retries);
+	write_csr(0x80D, backoff);
+}
+
+/*
+ * Bytes of the last put or get command that were transferred, counted
+ * across its segments. If it failed, these are the bytes before the fault.
+ */
+static inline unsigned long dma_bytes_done(void)
+{
+	return read_csr(0x80E);
+}
+
+/*
+ * Choose whether received blocks are allocated in the shared L2
+ * (the default) or written around it to memory.
+ */
+static inline void dma_set_cache_alloc(int enable)
+{
+	write_csr(0x80F, enable);
+}
+
+/*
+ * CRC32C of the bytes moved by the last put or get command,
+ * covering every one of its segments in order
+ */
+static inline unsigned int dma_send_crc(void)
+{
+	return read_csr(0x810);
+}
+
+/* CRC32C of the bytes received by puts since the last clear */
+static inline unsigned int dma_recv_crc(void)
+{
+	return read_csr(0x811);
+}
+
+static inline void dma_clear_recv_crc(void)
+{
+	write_csr(0x811, 0);
+}
+
+/*
+ * Start writing trace records into a ring of nrecords entries
+ * (a power of two) at the physical address phys_base.
+ */
+static inline void dma_trace_start(unsigned long phys_base,
+		unsigned long nrecords)
+{
+	write_csr(0x813, phys_base);
+	write_csr(0x815, 0);
+	write_csr(0x814, nrecords);
+}
+
+/* whether records are still waiting to be written to the ring */
+static inline int dma_trace_pending(void)
+{
+	return read_csr(0x823);
+}
+
+/*
+ * Wait for the records of everything that has finished to reach the
+ * ring, then stop. Records of events after that are thrown away and
+ * counted as dropped.
+ */
+static inline void dma_trace_stop(void)
+{
+	while (dma_trace_pending())
+		;
+	write_csr(0x814, 0);
+}
+
+/* total number of records written since the trace was started */
+static inline unsigned long dma_trace_head(void)
+{
+	return read_csr(0x815);
+}
+
+/*
+ * number of events lost because the trace unit fell behind,
+ * or because tracing was stopped while they were queued
+ */
+static inline unsigned long dma_trace_dropped(void)
+{
+	return read_csr(0x816);
+}
+
+#define DMA_WINDOW_READ 1
+#define DMA_WINDOW_WRITE 2
+
+/*
+ * Let remote senders access the blocks entirely inside [base, base + size)
+ * through the local port. perms is DMA_WINDOW_READ for gets and/or
+ * DMA_WINDOW_WRITE for puts. If key is nonzero, only a sender bound to
+ * port key may use the window. Windows only restrict anything once
+ * checking is turned on with dma_check_windows.
+ */
+static inline void dma_register_window(int index, void *base,
+		unsigned long size, unsigned short port,
+		unsigned short key, int perms)
+{
+	write_csr(0x817, index);
+	write_csr(0x818, base);
+	write_csr(0x819, size);
+	write_csr(0x81A, port);
+	write_csr(0x81B, key);
+	write_csr(0x81C, perms);
+}
+
+static inline void dma_unregister_window(int index)
+{
+	write_csr(0x817, index);
+	write_csr(0x81C, 0);
+}
+
+static inline void dma_check_windows(int enable)
+{
+	write_csr(0x81D, enable);
+}
+
+/* number of requests rejected for falling outside every window */
+static inline unsigned long dma_window_rejects(void)
+{
+	return read_csr(0x81E);
+}
+
+/*
+ * Drop the translations the receiver has cached for incoming requests.
+ * The kernel's sfence.vm after changing a page table already does this,
+ * so this is only needed where a mapping changes without one.
+ */
+static inline void dma_flush_translations(void)
+{
+	write_csr(0x822, 0);
+}
+
+/*
+ * Hardware contexts, one per address space. The kernel selects the
+ * context of the process it switches to by its (16-bit) ASID; the process
+ * gets back the CSRs, binding and transfer status it left behind, or a
+ * fresh context if it has none. Only the running process's memory can be
+ * reached through virtual addresses, so puts to a context that is not
+ * running are nacked, and its own queued commands fail with a page fault
+ * if they need a page walk, unless it uses physical addresses. To avoid
+ * that, the kernel can fence before switching.
+ *
+ * Returns -1 if every context still has commands in flight, in which
+ * case nothing changes and the kernel has to wait and try again.
+ */
+static inline int dma_select_context(unsigned long asid)
+{
+	write_csr(0x81F, asid);
+	return (read_csr(0x81F) == (asid & 0xffff)) ? 0 : -1;
+}
+
+static inline unsigned long dma_context_asid(void)
+{
+	return read_csr(0x81F);
+}
+
+/* free the context of an exiting process */
+static inline void dma_release_context(unsigned long asid)
+{
+	write_csr(0x820, asid);
+}
+
 static inline void dma_read_src_addr(struct dma_addr *addr)
 {
 	addr->addr = read_csr(0x808);
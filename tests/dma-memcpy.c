@@ -0,0 +1,255 @@
+/*
+ * LD_PRELOAD shim that hands large memcpy and memmove calls to the DMA
+ * engine as a put to the process's own address. Small and overlapping
+ * copies stay on the CPU, and if the engine stops part way (e.g. on a page
+ * that is not mapped in yet) the CPU copies the rest.
+ *
+ * The smallest size worth offloading is measured at startup by timing both
+ * ways of copying over a range of sizes. Environment variables:
+ *
+ *   DMA_MEMCPY_THRESHOLD  offload copies of at least this many bytes
+ *                         instead of calibrating
+ *   DMA_MEMCPY_PORT       port to bind to if the process is not bound yet;
+ *                         without it an unbound process is not offloaded,
+ *                         since every process would pick the same port
+ *   DMA_MEMCPY_VERBOSE    print the threshold to stderr at startup
+ *
+ * The engine asks for write permission when it walks the destination's
+ * page table, so a read-only or copy-on-write page (e.g. after fork) makes
+ * it stop there, and the CPU copy takes the page fault that breaks the
+ * sharing. Without that, offloading arbitrary copies would be unsafe.
+ *
+ * Each copy saves the transfer CSRs it changes and the status the
+ * application last saw, and puts them back afterwards. They are still
+ * shared by everything running on the core, so offloaded copies must not
+ * race with the application's own transfers or with another thread's
+ * copies on the same core.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "dma-ext.h"
+
+#define CALIB_MIN 1024
+#define CALIB_MAX (1024 * 1024)
+#define CALIB_TRIALS 3
+#define NO_OFFLOAD ((size_t) -1)
+
+typedef void *(*copy_fn)(void *, const void *, size_t);
+
+static copy_fn real_memcpy, real_memmove;
+static size_t threshold = NO_OFFLOAD;
+static int resolving;
+
+// only used while dlsym is looking up the real functions
+static void *slow_copy(void *dst, const void *src, size_t n)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+	if (d < s) {
+		while (n--)
+			*d++ = *s++;
+	} else {
+		while (n--)
+			d[n] = s[n];
+	}
+	return dst;
+}
+
+static void resolve(void)
+{
+	resolving = 1;
+	real_memcpy = dlsym(RTLD_NEXT, "memcpy");
+	real_memmove = dlsym(RTLD_NEXT, "memmove");
+	resolving = 0;
+}
+
+static inline int overlaps(void *dst, const void *src, size_t n)
+{
+	const char *d = dst, *s = src;
+
+	return d < s + n && s < d + n;
+}
+
+/* the application's transfer setup and status, which a copy overwrites */
+struct saved_csrs {
+	unsigned long segsize, src_stride, dst_stride, nsegments;
+	unsigned long remote_addr, remote_port, transpose, accum;
+	unsigned long error, bytes_done, crc;
+};
+
+static void save_csrs(struct saved_csrs *s)
+{
+	s->segsize = read_csr(0x800);
+	s->src_stride = read_csr(0x801);
+	s->dst_stride = read_csr(0x802);
+	s->nsegments = read_csr(0x803);
+	s->remote_addr = read_csr(0x806);
+	s->remote_port = read_csr(0x807);
+	s->transpose = read_csr(0x812);
+	s->accum = read_csr(0x821);
+	s->error = read_csr(0x80A);
+	s->bytes_done = read_csr(0x80E);
+	s->crc = read_csr(0x810);
+}
+
+/* only while the engine is idle, after the copy's fence */
+static void restore_csrs(struct saved_csrs *s)
+{
+	write_csr(0x800, s->segsize);
+	write_csr(0x801, s->src_stride);
+	write_csr(0x802, s->dst_stride);
+	write_csr(0x803, s->nsegments);
+	write_csr(0x806, s->remote_addr);
+	write_csr(0x807, s->remote_port);
+	write_csr(0x812, s->transpose);
+	write_csr(0x821, s->accum);
+	write_csr(0x80A, s->error);
+	write_csr(0x80E, s->bytes_done);
+	write_csr(0x810, s->crc);
+}
+
+/* returns how many bytes the engine copied before it stopped */
+static size_t dma_copy(void *dst, const void *src, size_t n)
+{
+	struct saved_csrs saved;
+	struct dma_addr self;
+	size_t done = n;
+
+	// the application's own transfers have to finish first
+	dma_fence();
+	save_csrs(&saved);
+
+	dma_read_local_addr(&self);
+	dma_contig_put(&self, dst, (void *) src, n);
+	dma_fence();
+
+	if (dma_send_error())
+		done = dma_bytes_done();
+
+	restore_csrs(&saved);
+	return done;
+}
+
+static void *offload(copy_fn cpu, void *dst, const void *src, size_t n)
+{
+	size_t done;
+
+	if (n == 0 || n < threshold || overlaps(dst, src, n))
+		return cpu(dst, src, n);
+
+	done = dma_copy(dst, src, n);
+	if (done < n)
+		cpu((char *) dst + done, (const char *) src + done, n - done);
+
+	return dst;
+}
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+	if (!real_memcpy) {
+		if (resolving)
+			return slow_copy(dst, src, n);
+		resolve();
+	}
+	return offload(real_memcpy, dst, src, n);
+}
+
+void *memmove(void *dst, const void *src, size_t n)
+{
+	if (!real_memmove) {
+		if (resolving)
+			return slow_copy(dst, src, n);
+		resolve();
+	}
+	return offload(real_memmove, dst, src, n);
+}
+
+static unsigned long time_copy(int use_dma, void *dst, void *src, size_t n)
+{
+	unsigned long start, cycles, best = ULONG_MAX;
+	int i;
+
+	for (i = 0; i < CALIB_TRIALS; i++) {
+		start = read_csr(cycle);
+		if (use_dma) {
+			if (dma_copy(dst, src, n) < n)
+				return ULONG_MAX;
+		} else {
+			real_memcpy(dst, src, n);
+		}
+		cycles = read_csr(cycle) - start;
+		if (cycles < best)
+			best = cycles;
+	}
+
+	return best;
+}
+
+/*
+ * Going down from the largest size, find the smallest size from which
+ * the engine is faster than the CPU at every size measured.
+ */
+static size_t calibrate(void)
+{
+	size_t n, best = NO_OFFLOAD;
+	char *buf;
+
+	buf = mmap(NULL, 2 * CALIB_MAX, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (buf == MAP_FAILED)
+		return NO_OFFLOAD;
+
+	for (n = CALIB_MAX; n >= CALIB_MIN; n >>= 1) {
+		if (time_copy(1, buf + CALIB_MAX, buf, n) >=
+				time_copy(0, buf + CALIB_MAX, buf, n))
+			break;
+		best = n;
+	}
+
+	munmap(buf, 2 * CALIB_MAX);
+	return best;
+}
+
+static void __attribute__((constructor)) dma_memcpy_init(void)
+{
+	struct dma_addr self;
+	const char *env;
+
+	if (!real_memcpy)
+		resolve();
+
+	dma_read_local_addr(&self);
+	if (self.port == 0) {
+		env = getenv("DMA_MEMCPY_PORT");
+		if (!env) {
+			fprintf(stderr, "dma-memcpy: process has no port and "
+					"DMA_MEMCPY_PORT is not set, "
+					"offload disabled\n");
+			return;
+		}
+		self.port = strtoul(env, NULL, 0);
+		dma_bind_addr(&self);
+	}
+
+	env = getenv("DMA_MEMCPY_THRESHOLD");
+	if (env)
+		threshold = strtoul(env, NULL, 0);
+	else
+		threshold = calibrate();
+
+	if (getenv("DMA_MEMCPY_VERBOSE")) {
+		if (threshold == NO_OFFLOAD)
+			fprintf(stderr, "dma-memcpy: offload disabled\n");
+		else
+			fprintf(stderr, "dma-memcpy: offloading copies "
+					"of %lu bytes or more\n",
+					(unsigned long) threshold);
+	}
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dma-trace.h"
+
+/* these must be in the same order as the states in dma.scala */
+static const char *tx_states[] = {
+	"idle", "prepare_write", "ptw_req", "ptw_resp",
+	"wait_data", "net_put_acquire", "net_put_grant",
+	"dmem_get_acquire", "dmem_get_grant", "copy_data",
+	"dmem_put_acquire", "dmem_put_grant", "backoff"
+};
+
+static const char *tx_fill_states[] = {
+	"idle", "prepare_read", "ptw_req", "ptw_resp",
+	"dmem_get_acquire", "dmem_get_grant",
+	"net_get_acquire", "net_get_grant", "net_get_drain",
+	"backoff", "elem_req", "elem_acquire", "elem_grant"
+};
+
+static const char *rx_states[] = {
+	"idle", "recv", "ack", "prepare_recv",
+	"get_acquire", "get_grant", "put_acquire", "put_grant",
+	"ptw_req", "ptw_resp", "discard", "stream_ack"
+};
+
+#define NTX_STATES (sizeof(tx_states) / sizeof(tx_states[0]))
+#define NRX_STATES (sizeof(rx_states) / sizeof(rx_states[0]))
+#define NFILL_STATES (sizeof(tx_fill_states) / sizeof(tx_fill_states[0]))
+#define NXACTS 256
+
+const char *dma_trace_state_name(int source, int code)
+{
+	if (source == DMA_TRACE_TX && code < NTX_STATES)
+		return tx_states[code];
+	if (source == DMA_TRACE_RX && code < NRX_STATES)
+		return rx_states[code];
+	if (source == DMA_TRACE_TX_FILL && code < NFILL_STATES)
+		return tx_fill_states[code];
+	return "unknown";
+}
+
+static void print_states(int source, uint64_t *cycles, int nstates)
+{
+	int i;
+
+	for (i = 1; i < nstates; i++) {
+		if (cycles[i] == 0)
+			continue;
+		printf("  %-18s %10lu\n", dma_trace_state_name(source, i),
+				(unsigned long) cycles[i]);
+	}
+}
+
+void dma_trace_report(struct dma_trace_record *ring,
+		unsigned long nrecords, unsigned long head,
+		unsigned long dropped)
+{
+	uint64_t dequeued[NXACTS];
+	uint64_t tx_cycles[NTX_STATES], rx_cycles[NRX_STATES];
+	uint64_t fill_cycles[NFILL_STATES];
+	uint64_t tx_last = 0, tx_start = 0, rx_last = 0, fill_last = 0;
+	int tx_state = 0, rx_state = 0, fill_state = 0;
+	unsigned long i, start;
+
+	memset(dequeued, 0, sizeof(dequeued));
+	memset(tx_cycles, 0, sizeof(tx_cycles));
+	memset(rx_cycles, 0, sizeof(rx_cycles));
+	memset(fill_cycles, 0, sizeof(fill_cycles));
+
+	start = (head > nrecords) ? head - nrecords : 0;
+	if (start > 0)
+		printf("trace wrapped, dropping %lu oldest records\n", start);
+
+	for (i = start; i < head; i++) {
+		struct dma_trace_record *rec = &ring[i % nrecords];
+
+		if ((rec->seq & 0xffffffffUL) != (i & 0xffffffffUL)) {
+			printf("record %lu has sequence %u\n", i, rec->seq);
+			continue;
+		}
+
+		switch (rec->source) {
+		case DMA_TRACE_SENDER:
+			dequeued[rec->xact_id] = rec->timestamp;
+			break;
+		case DMA_TRACE_TX:
+			if (rec->code >= NTX_STATES)
+				break;
+			if (tx_state == 0) {
+				tx_start = rec->timestamp;
+				memset(tx_cycles, 0, sizeof(tx_cycles));
+			} else {
+				tx_cycles[tx_state] += rec->timestamp - tx_last;
+			}
+			if (rec->code == 0) {
+				printf("xact %u: %lu cycles",
+					rec->xact_id, (unsigned long)
+					(rec->timestamp - tx_start));
+				if (dequeued[rec->xact_id] != 0)
+					printf(" (%lu since dequeued)",
+						(unsigned long) (rec->timestamp -
+						dequeued[rec->xact_id]));
+				if (rec->info != 0)
+					printf(", error %u", rec->info);
+				printf("\n");
+				print_states(DMA_TRACE_TX, tx_cycles,
+						NTX_STATES);
+			}
+			tx_state = rec->code;
+			tx_last = rec->timestamp;
+			break;
+		case DMA_TRACE_RX:
+			if (rec->code >= NRX_STATES)
+				break;
+			if (rx_state != 0)
+				rx_cycles[rx_state] += rec->timestamp - rx_last;
+			rx_state = rec->code;
+			rx_last = rec->timestamp;
+			break;
+		case DMA_TRACE_TX_FILL:
+			if (rec->code >= NFILL_STATES)
+				break;
+			if (fill_state != 0)
+				fill_cycles[fill_state] +=
+					rec->timestamp - fill_last;
+			fill_state = rec->code;
+			fill_last = rec->timestamp;
+			break;
+		}
+	}
+
+	if (dropped)
+		printf("%lu events were dropped; the time in the states they "
+			"entered is counted toward the states before them\n",
+			dropped);
+
+	printf("tx fill totals:\n");
+	print_states(DMA_TRACE_TX_FILL, fill_cycles, NFILL_STATES);
+	printf("rx totals:\n");
+	print_states(DMA_TRACE_RX, rx_cycles, NRX_STATES);
+}
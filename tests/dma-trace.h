@@ -0,0 +1,37 @@
+#ifndef DMA_TRACE_H
+#define DMA_TRACE_H
+
+#include <stdint.h>
+
+#define DMA_TRACE_SENDER 0
+#define DMA_TRACE_TX 1
+#define DMA_TRACE_RX 2
+#define DMA_TRACE_TX_FILL 3
+
+/* one record as written by the trace unit, one memory beat each */
+struct dma_trace_record {
+	uint64_t timestamp;
+	uint8_t source;
+	uint8_t code;
+	uint8_t info;
+	uint8_t xact_id;
+	uint32_t seq;
+} __attribute__((aligned(16)));
+
+const char *dma_trace_state_name(int source, int code);
+
+/*
+ * Print the time Tx spent in each state for every command in the ring,
+ * followed by the total time the Tx fill side and Rx spent in each state.
+ * head is the number of records written so far (the TRACE_HEAD CSR) and
+ * dropped the number of events the trace unit lost (TRACE_DROPS).
+ *
+ * Times are taken between consecutive records of a source, so when a
+ * record is dropped, the time in the state it would have entered is
+ * counted toward the state before it. The report warns when that happens.
+ */
+void dma_trace_report(struct dma_trace_record *ring,
+		unsigned long nrecords, unsigned long head,
+		unsigned long dropped);
+
+#endif
@@ -22,6 +22,9 @@ int main(void)
 	if (err != DMA_TX_PAGEFAULT)
 		return (0x10 | err);
 
+	if (dma_bytes_done() != 0)
+		return 0x18;
+
 	// now turn it back on
 	write_csr(0x80B, 1);
 
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "barrier.h"
+#include "channel.h"
+
+#define NSLOTS 64
+#define SLOT_SIZE 4096
+#define NPINGS 1000
+#define NMSGS 10000
+
+#define PARENT_PORT 100
+#define CHILD_PORT 101
+
+static const unsigned long sizes[] = {8, 64, 1024, SLOT_SIZE};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static void *ping_mem, *pong_mem;
+static uint8_t *buf;
+
+static void fail(const char *what, int err)
+{
+	fprintf(stderr, "%s failed with code %d\n", what, err);
+	exit(EXIT_FAILURE);
+}
+
+static void setup(struct barrier *barrier, struct dma_channel *ping,
+		struct dma_channel *pong, int local_port, int remote_port)
+{
+	struct dma_addr local_addr, remote_addr;
+
+	local_addr.addr = 0;
+	local_addr.port = local_port;
+	dma_bind_addr(&local_addr);
+
+	remote_addr.addr = 0;
+	remote_addr.port = remote_port;
+
+	dma_chan_init(ping, ping_mem, NSLOTS, SLOT_SIZE, &remote_addr);
+	dma_chan_init(pong, pong_mem, NSLOTS, SLOT_SIZE, &remote_addr);
+
+	buf = malloc(SLOT_SIZE);
+	memset(buf, 0, SLOT_SIZE);
+
+	// both ends of both channels are ready after this
+	barrier_wait(barrier);
+}
+
+static int parent_process(struct barrier *barrier)
+{
+	struct dma_channel ping, pong;
+	unsigned long start, cycles, len;
+	uint64_t *msg;
+	int i, j, err;
+
+	setup(barrier, &ping, &pong, PARENT_PORT, CHILD_PORT);
+
+	for (i = 0; i < NSIZES; i++) {
+		for (j = 0; j < sizes[i]; j++)
+			buf[j] = (i + j) & 0xff;
+
+		start = read_csr(cycle);
+		for (j = 0; j < NPINGS; j++) {
+			err = dma_chan_send(&ping, buf, sizes[i]);
+			if (err)
+				fail("dma_chan_send", err);
+			msg = dma_chan_recv(&pong, &len);
+			if (len != sizes[i] || memcmp(msg, buf, len)) {
+				printf("pong %d of %lu bytes is wrong\n",
+						j, sizes[i]);
+				return -1;
+			}
+			err = dma_chan_release(&pong);
+			if (err)
+				fail("dma_chan_release", err);
+		}
+		cycles = read_csr(cycle) - start;
+
+		printf("ping-pong %4lu bytes: %6lu cycles one way\n",
+				sizes[i], cycles / (2 * NPINGS));
+	}
+
+	start = read_csr(cycle);
+	for (j = 0; j < NMSGS; j++) {
+		*(uint64_t *) buf = j;
+		err = dma_chan_send(&ping, buf, sizeof(uint64_t));
+		if (err)
+			fail("dma_chan_send", err);
+	}
+	// wait for the receiver to get through all of them
+	dma_chan_recv(&pong, &len);
+	cycles = read_csr(cycle) - start;
+	dma_chan_release(&pong);
+
+	printf("streamed %d messages: %lu cycles, %.2f messages per 1000 cycles\n",
+			NMSGS, cycles, 1000.0 * NMSGS / cycles);
+
+	return 0;
+}
+
+static int child_process(struct barrier *barrier)
+{
+	struct dma_channel ping, pong;
+	unsigned long len;
+	uint64_t *msg;
+	int i, j, err, error = 0;
+
+	setup(barrier, &ping, &pong, CHILD_PORT, PARENT_PORT);
+
+	for (i = 0; i < NSIZES; i++) {
+		for (j = 0; j < NPINGS; j++) {
+			msg = dma_chan_recv(&ping, &len);
+			// echo the message straight out of the ring
+			err = dma_chan_send(&pong, msg, len);
+			if (err)
+				fail("dma_chan_send", err);
+			err = dma_chan_release(&ping);
+			if (err)
+				fail("dma_chan_release", err);
+		}
+	}
+
+	for (j = 0; j < NMSGS; j++) {
+		msg = dma_chan_recv(&ping, &len);
+		if (len != sizeof(uint64_t) || *msg != j) {
+			if (!error)
+				printf("message %d is wrong\n", j);
+			error = 1;
+		}
+		err = dma_chan_release(&ping);
+		if (err)
+			fail("dma_chan_release", err);
+	}
+
+	err = dma_chan_send(&pong, buf, 0);
+	if (err)
+		fail("dma_chan_send", err);
+
+	return error;
+}
+
+int main(void)
+{
+	struct barrier barrier;
+	pid_t id;
+	int ret, child_status;
+
+	ping_mem = malloc(dma_chan_size(NSLOTS, SLOT_SIZE));
+	pong_mem = malloc(dma_chan_size(NSLOTS, SLOT_SIZE));
+
+	if (barrier_init(&barrier, "chan-barrier", 2)) {
+		perror("barrier_init");
+		return -1;
+	}
+
+	id = fork();
+	if (id < 0)
+		abort();
+	else if (id == 0) {
+		ret = child_process(&barrier);
+	} else {
+		ret = parent_process(&barrier);
+
+		if (waitpid(id, &child_status, 0) < 0) {
+			perror("waitpid");
+			return -1;
+		}
+
+		if (WEXITSTATUS(child_status) != 0)
+			ret = -1;
+		if (!ret)
+			printf("Channels completed without errors\n");
+	}
+
+	free(ping_mem);
+	free(pong_mem);
+
+	if (barrier_close(&barrier)) {
+		perror("barrier_close");
+		return -1;
+	}
+
+	return ret;
+}
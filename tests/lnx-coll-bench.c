@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "collectives.h"
+#include "dma-ext.h"
+
+#define MAX_PROCS 8
+#define MAX_BYTES (64 * 1024)
+#define BUF_BYTES (MAX_PROCS * MAX_BYTES)
+#define WORK_BYTES (3 * MAX_PROCS * DMA_COLL_SHORT_MSG + 2 * MAX_BYTES)
+#define NITERS 4
+#define BASE_PORT 100
+
+static const unsigned long sizes[] = {64, 1024, 16 * 1024, MAX_BYTES};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+enum coll {
+	COLL_BROADCAST,
+	COLL_SCATTER,
+	COLL_GATHER,
+	COLL_ALLGATHER,
+	COLL_ALLTOALL,
+	COLL_REDUCE_SCATTER,
+	NCOLLS
+};
+
+static const char *coll_names[NCOLLS] = {
+	"broadcast", "scatter", "gather",
+	"allgather", "alltoall", "reduce_scatter",
+};
+
+static uint8_t *src, *dst;
+
+static inline uint8_t pattern(int seed, unsigned long i)
+{
+	return (seed * 131 + i * 7 + 1) & 0xff;
+}
+
+static void fill(uint8_t *buf, int seed, unsigned long nbytes)
+{
+	unsigned long i;
+
+	for (i = 0; i < nbytes; i++)
+		buf[i] = pattern(seed, i);
+}
+
+static int check(const char *name, uint8_t *buf, int seed,
+		unsigned long nbytes)
+{
+	unsigned long i;
+
+	for (i = 0; i < nbytes; i++) {
+		if (buf[i] != pattern(seed, i)) {
+			printf("%s: byte %lu expected %x, got %x\n",
+					name, i, pattern(seed, i), buf[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void prepare(struct dma_comm *comm, enum coll coll,
+		unsigned long nbytes, int root)
+{
+	int p = comm->size, rank = comm->rank, i;
+	int64_t *vec = (int64_t *) src;
+	unsigned long count = nbytes / sizeof(int64_t), e;
+
+	memset(dst, 0, p * nbytes);
+
+	switch (coll) {
+	case COLL_BROADCAST:
+		if (rank == root)
+			fill(dst, root, nbytes);
+		break;
+	case COLL_SCATTER:
+		for (i = 0; i < p; i++)
+			fill(src + i * nbytes, i, nbytes);
+		break;
+	case COLL_GATHER:
+	case COLL_ALLGATHER:
+		fill(src, rank, nbytes);
+		break;
+	case COLL_ALLTOALL:
+		for (i = 0; i < p; i++)
+			fill(src + i * nbytes, rank * p + i, nbytes);
+		break;
+	case COLL_REDUCE_SCATTER:
+		for (e = 0; e < p * count; e++)
+			vec[e] = rank + e;
+		break;
+	default:
+		break;
+	}
+}
+
+static int run(struct dma_comm *comm, enum coll coll,
+		unsigned long nbytes, int root)
+{
+	switch (coll) {
+	case COLL_BROADCAST:
+		return dma_broadcast(comm, dst, nbytes, root);
+	case COLL_SCATTER:
+		return dma_scatter(comm, dst, src, nbytes, root);
+	case COLL_GATHER:
+		return dma_gather(comm, dst, src, nbytes, root);
+	case COLL_ALLGATHER:
+		return dma_allgather(comm, dst, src, nbytes);
+	case COLL_ALLTOALL:
+		return dma_alltoall(comm, dst, src, nbytes);
+	case COLL_REDUCE_SCATTER:
+		return dma_reduce_scatter(comm, (int64_t *) dst,
+				(int64_t *) src, nbytes / sizeof(int64_t),
+				DMA_REDUCE_SUM);
+	default:
+		return -1;
+	}
+}
+
+static int verify(struct dma_comm *comm, enum coll coll,
+		unsigned long nbytes, int root)
+{
+	int p = comm->size, rank = comm->rank, i;
+	const char *name = coll_names[coll];
+	int64_t *vec = (int64_t *) dst, expected;
+	unsigned long count = nbytes / sizeof(int64_t), e;
+
+	switch (coll) {
+	case COLL_BROADCAST:
+		return check(name, dst, root, nbytes);
+	case COLL_SCATTER:
+		return check(name, dst, rank, nbytes);
+	case COLL_GATHER:
+		if (rank != root)
+			return 0;
+		// fall through
+	case COLL_ALLGATHER:
+		for (i = 0; i < p; i++)
+			if (check(name, dst + i * nbytes, i, nbytes))
+				return -1;
+		return 0;
+	case COLL_ALLTOALL:
+		for (i = 0; i < p; i++)
+			if (check(name, dst + i * nbytes, i * p + rank, nbytes))
+				return -1;
+		return 0;
+	case COLL_REDUCE_SCATTER:
+		for (e = 0; e < count; e++) {
+			expected = p * (p - 1) / 2 + p * (rank * count + e);
+			if (vec[e] != expected) {
+				printf("%s: element %lu expected %ld, got %ld\n",
+						name, e, (long) expected,
+						(long) vec[e]);
+				return -1;
+			}
+		}
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* bytes of the whole result, as algorithm bandwidth is usually quoted */
+static unsigned long coll_bytes(enum coll coll, int p, unsigned long nbytes)
+{
+	if (coll == COLL_BROADCAST)
+		return nbytes;
+	return p * nbytes;
+}
+
+static int process(struct dma_comm *comm, int rank)
+{
+	unsigned long start, cycles, total, bytes;
+	int coll, size, iter, root, ret;
+
+	dma_comm_join(comm, rank);
+
+	memset(src, 0, BUF_BYTES);
+	memset(dst, 0, BUF_BYTES);
+
+	for (coll = 0; coll < NCOLLS; coll++) {
+		for (size = 0; size < NSIZES; size++) {
+			total = 0;
+
+			for (iter = 0; iter < NITERS; iter++) {
+				root = iter % comm->size;
+				prepare(comm, coll, sizes[size], root);
+
+				start = read_csr(cycle);
+				ret = run(comm, coll, sizes[size], root);
+				if (!ret)
+					ret = dma_coll_barrier(comm);
+				cycles = read_csr(cycle) - start;
+
+				if (ret) {
+					fprintf(stderr, "%s failed with code %d\n",
+							coll_names[coll], ret);
+					return -1;
+				}
+				if (verify(comm, coll, sizes[size], root))
+					return -1;
+
+				total += cycles;
+			}
+
+			if (rank == 0) {
+				bytes = coll_bytes(coll, comm->size, sizes[size]);
+				printf("%-14s %2d procs %6lu bytes %9lu cycles "
+						"%6.2f B/cycle\n",
+						coll_names[coll], comm->size,
+						sizes[size], total / NITERS,
+						(double) bytes * NITERS / total);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int bench(int nprocs)
+{
+	struct dma_comm comm;
+	pid_t ids[MAX_PROCS];
+	int i, status, ret;
+
+	if (dma_comm_init(&comm, "coll-bench", nprocs, BASE_PORT, WORK_BYTES)) {
+		perror("dma_comm_init");
+		return -1;
+	}
+
+	for (i = 1; i < nprocs; i++) {
+		ids[i] = fork();
+		if (ids[i] < 0)
+			abort();
+		if (ids[i] == 0)
+			exit(process(&comm, i) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	ret = process(&comm, 0);
+
+	for (i = 1; i < nprocs; i++) {
+		if (waitpid(ids[i], &status, 0) < 0) {
+			perror("waitpid");
+			return -1;
+		}
+		if (WEXITSTATUS(status) != 0) {
+			printf("process %d failed\n", i);
+			ret = -1;
+		}
+	}
+
+	if (dma_comm_close(&comm)) {
+		perror("dma_comm_close");
+		return -1;
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int nprocs, max_procs = 4;
+
+	if (argc > 1)
+		max_procs = atoi(argv[1]);
+	if (max_procs < 2 || max_procs > MAX_PROCS) {
+		fprintf(stderr, "Usage: %s [max processes, 2 to %d]\n",
+				argv[0], MAX_PROCS);
+		return -1;
+	}
+
+	src = malloc(BUF_BYTES);
+	dst = malloc(BUF_BYTES);
+
+	for (nprocs = 2; nprocs <= max_procs; nprocs++) {
+		if (bench(nprocs))
+			return -1;
+	}
+
+	printf("Collectives completed without errors\n");
+
+	free(src);
+	free(dst);
+
+	return 0;
+}
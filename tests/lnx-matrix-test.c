@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "barrier.h"
+#include "dma-alloc.h"
 #include "dma-ext.h"
 
 #define N 128
@@ -18,6 +19,8 @@
 #define MASTER_PORT 100
 #define SLAVE_PORT 101
 
+#define ARENA_SIZE (2 * 1024 * 1024)
+
 static int check_matrix(int *mat_a, int *mat_b)
 {
 	int a, b, i, j, error_count = 0;
@@ -156,6 +159,19 @@ int slave_process(struct barrier *barrier, int *mat_a, int *mat_b)
 	return error;
 }
 
+// each process gets its own locked arena, at the same address in both,
+// so that the matrices are where the other side expects them
+static void alloc_matrices(int **mat_a, int **mat_b)
+{
+	if (dma_arena_init(DMA_ARENA_ADDR, ARENA_SIZE)) {
+		perror("dma_arena_init");
+		exit(EXIT_FAILURE);
+	}
+
+	*mat_a = dma_alloc(N * N * sizeof(int));
+	*mat_b = dma_alloc(M * M * sizeof(int));
+}
+
 int main(void)
 {
 	int *mat_a, *mat_b;
@@ -163,9 +179,6 @@ int main(void)
 	struct barrier barrier;
 	int ret, slave_status;
 
-	mat_a = malloc(N * N * sizeof(int));
-	mat_b = malloc(M * M * sizeof(int));
-
 	if (barrier_init(&barrier, "matrix-barrier", 2)) {
 		perror("barrier_init");
 		return -1;
@@ -175,8 +188,10 @@ int main(void)
 	if (id < 0)
 		abort();
 	else if (id == 0) {
+		alloc_matrices(&mat_a, &mat_b);
 		ret = slave_process(&barrier, mat_a, mat_b);
 	} else {
+		alloc_matrices(&mat_a, &mat_b);
 		ret = master_process(&barrier, mat_a, mat_b);
 
 		if (waitpid(id, &slave_status, 0) < 0) {
@@ -190,8 +205,9 @@ int main(void)
 			printf("Slave process completed without errors\n");
 	}
 
-	free(mat_a);
-	free(mat_b);
+	dma_free(mat_a);
+	dma_free(mat_b);
+	dma_arena_destroy();
 
 	if (barrier_close(&barrier)) {
 		perror("barrier_close");
@@ -0,0 +1,128 @@
+/*
+ * Checks memcpy and memmove over a range of sizes and alignments and
+ * prints how long each size takes. Run it as
+ *
+ *   LD_PRELOAD=./libdma-memcpy.so ./lnx-memcpy-test
+ *
+ * to exercise the offload shim.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "dma-ext.h"
+
+#define MAX_BYTES (1024 * 1024)
+#define BUF_BYTES (MAX_BYTES + 64)
+
+static const unsigned long sizes[] = {
+	16, 256, 4096, 16 * 1024, 64 * 1024, 256 * 1024, MAX_BYTES
+};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static const int offsets[][2] = { {0, 0}, {3, 0}, {0, 5}, {7, 13} };
+#define NOFFSETS (sizeof(offsets) / sizeof(offsets[0]))
+
+static int check(const char *name, uint8_t *dst, uint8_t *expected,
+		unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if (dst[i] != expected[i]) {
+			printf("%s of %lu bytes: byte %lu expected %x, got %x\n",
+					name, n, i, expected[i], dst[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static uint8_t *fresh_pages(unsigned long n)
+{
+	uint8_t *buf = mmap(NULL, n, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (buf == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	return buf;
+}
+
+int main(void)
+{
+	uint8_t *src, *dst, *ref;
+	unsigned long start, cycles, n;
+	unsigned long i, j;
+	int errors = 0;
+
+	src = malloc(BUF_BYTES);
+	dst = malloc(BUF_BYTES);
+	ref = malloc(BUF_BYTES);
+
+	for (i = 0; i < BUF_BYTES; i++)
+		src[i] = (i * 7 + 3) & 0xff;
+
+	for (i = 0; i < NSIZES; i++) {
+		n = sizes[i];
+		for (j = 0; j < NOFFSETS; j++) {
+			memset(dst, 0, BUF_BYTES);
+
+			start = read_csr(cycle);
+			memcpy(dst + offsets[j][1], src + offsets[j][0], n);
+			cycles = read_csr(cycle) - start;
+
+			if (check("memcpy", dst + offsets[j][1],
+					src + offsets[j][0], n))
+				errors++;
+			if (j == 0)
+				printf("memcpy %7lu bytes: %8lu cycles\n",
+						n, cycles);
+		}
+	}
+
+	// overlapping moves have to stay correct
+	for (i = 0; i < NSIZES; i++) {
+		n = sizes[i];
+		for (j = 0; j < BUF_BYTES; j++)
+			ref[j] = dst[j] = src[j];
+
+		memmove(dst + 32, dst, n);
+		for (j = 0; j < n; j++)
+			ref[j + 32] = src[j];
+		if (check("memmove up", dst, ref, n + 32))
+			errors++;
+
+		for (j = 0; j < BUF_BYTES; j++)
+			ref[j] = dst[j] = src[j];
+
+		memmove(dst, dst + 32, n);
+		for (j = 0; j < n; j++)
+			ref[j] = src[j + 32];
+		if (check("memmove down", dst, ref, n + 32))
+			errors++;
+	}
+
+	// the destination pages are not mapped in yet, so an offloaded
+	// copy faults part way and has to be finished by the CPU
+	for (i = 0; i < NSIZES; i++) {
+		n = sizes[i];
+		dst = fresh_pages(n);
+		memcpy(dst, src, n);
+		if (check("memcpy to unmapped pages", dst, src, n))
+			errors++;
+		munmap(dst, n);
+	}
+
+	if (errors) {
+		printf("%d copies failed\n", errors);
+		return -1;
+	}
+
+	printf("All copies completed without errors\n");
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include <unistd.h>
 
 #include "barrier.h"
+#include "dma-alloc.h"
 #include "dma-ext.h"
 
 #define NITEMS 5000
@@ -20,6 +21,25 @@ struct unshared_state {
 #define PARENT_PORT 100
 #define CHILD_PORT 101
 
+#define ARENA_SIZE (2 * 1024 * 1024)
+
+// both processes allocate the same way, so the buffers
+// end up at the same address in each
+static struct unshared_state *alloc_state(void)
+{
+	struct unshared_state *unshared;
+
+	if (dma_arena_init(DMA_ARENA_ADDR, ARENA_SIZE)) {
+		perror("dma_arena_init");
+		exit(EXIT_FAILURE);
+	}
+
+	unshared = dma_alloc(sizeof(struct unshared_state));
+	memset(unshared, 0, sizeof(struct unshared_state));
+
+	return unshared;
+}
+
 void parent_thread(struct barrier *barrier, struct unshared_state *unshared)
 {
 	int i, ret;
@@ -82,10 +102,6 @@ int main(void)
 	struct barrier barrier;
 	pid_t pid;
 
-	unshared = malloc(sizeof(struct unshared_state));
-
-	memset(unshared, 0, sizeof(struct unshared_state));
-
 	if (barrier_init(&barrier, "simple-barrier", 2)) {
 		perror("barrier_init");
 		return -1;
@@ -97,6 +113,8 @@ int main(void)
 		exit(EXIT_FAILURE);
 	}
 
+	unshared = alloc_state();
+
 	if (pid == 0) {
 		child_thread(&barrier, unshared);
 	} else {
@@ -112,7 +130,8 @@ int main(void)
 		return -1;
 	}
 
-	free(unshared);
+	dma_free(unshared);
+	dma_arena_destroy();
 
 	return 0;
 }
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dma-ext.h"
+#include "dma-trace.h"
+
+#define NRECORDS 1024
+#define TRACE_BYTES (NRECORDS * sizeof(struct dma_trace_record))
+
+#define SEGSIZE 1024
+#define STRIDE 512
+#define NSEGMENTS 8
+
+#define PORT 100
+
+int main(int argc, char *argv[])
+{
+	struct dma_trace_record *ring;
+	struct dma_addr addr;
+	unsigned long phys_base;
+	uint8_t *src, *dst;
+	int fd, i, ret;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s phys_base\n", argv[0]);
+		fprintf(stderr, "phys_base must point to %lu bytes of "
+				"memory reserved for the trace\n",
+				(unsigned long) TRACE_BYTES);
+		return -1;
+	}
+
+	phys_base = strtoul(argv[1], NULL, 0);
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	ring = mmap(NULL, TRACE_BYTES, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, phys_base);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	memset(ring, 0, TRACE_BYTES);
+
+	src = malloc((SEGSIZE + STRIDE) * NSEGMENTS);
+	dst = malloc(SEGSIZE * NSEGMENTS);
+
+	for (i = 0; i < (SEGSIZE + STRIDE) * NSEGMENTS; i++)
+		src[i] = i & 0xff;
+
+	addr.addr = 0;
+	addr.port = PORT;
+	dma_bind_addr(&addr);
+
+	dma_trace_start(phys_base, NRECORDS);
+
+	dma_gather_put(&addr, dst, src, SEGSIZE, STRIDE, NSEGMENTS);
+	dma_fence();
+	ret = dma_send_error();
+
+	dma_trace_stop();
+
+	if (ret) {
+		fprintf(stderr, "dma_gather_put failed with code %d\n", ret);
+		return -1;
+	}
+
+	dma_trace_report(ring, NRECORDS, dma_trace_head(),
+			dma_trace_dropped());
+
+	munmap(ring, TRACE_BYTES);
+	close(fd);
+	free(src);
+	free(dst);
+
+	return 0;
+}
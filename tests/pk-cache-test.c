@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dma-ext.h"
+
+#define NBYTES (64 * 1024)
+#define NWORDS (NBYTES / sizeof(uint64_t))
+// must be larger than the L2 so that we can evict the destination
+#define FLUSH_BYTES (4 * 1024 * 1024)
+#define NTRIALS 4
+#define PORT 20
+
+static uint64_t *src, *dst;
+static uint8_t *flush_buf;
+
+static void flush_caches(void)
+{
+	int i;
+
+	for (i = 0; i < FLUSH_BYTES; i += 64)
+		flush_buf[i]++;
+}
+
+static int put_and_read(int alloc, unsigned long *cycles)
+{
+	struct dma_addr addr;
+	unsigned long start, end;
+	uint64_t sum = 0;
+	int i, err;
+
+	addr.addr = 0;
+	addr.port = PORT;
+
+	dma_set_cache_alloc(alloc);
+	flush_caches();
+
+	dma_contig_put(&addr, dst, src, NBYTES);
+	dma_fence();
+	err = dma_send_error();
+	if (err) {
+		printf("dma_contig_put failed %d\n", err);
+		return err;
+	}
+
+	// the consumer side: how long does it take to read what we received
+	start = read_csr(cycle);
+	for (i = 0; i < NWORDS; i++)
+		sum += dst[i];
+	end = read_csr(cycle);
+
+	if (sum != (uint64_t) NWORDS * (NWORDS - 1) / 2) {
+		printf("checksum mismatch\n");
+		return -1;
+	}
+
+	*cycles = end - start;
+	return 0;
+}
+
+int main(void)
+{
+	struct dma_addr addr;
+	unsigned long cycles, total[2] = {0, 0};
+	int i, trial, alloc;
+
+	src = malloc(NBYTES);
+	dst = malloc(NBYTES);
+	flush_buf = malloc(FLUSH_BYTES);
+
+	for (i = 0; i < NWORDS; i++) {
+		src[i] = i;
+		dst[i] = 0;
+	}
+	memset(flush_buf, 0, FLUSH_BYTES);
+
+	addr.addr = 0;
+	addr.port = PORT;
+	dma_bind_addr(&addr);
+
+	for (trial = 0; trial < NTRIALS; trial++) {
+		for (alloc = 0; alloc < 2; alloc++) {
+			memset(dst, 0, NBYTES);
+			if (put_and_read(alloc, &cycles))
+				return -1;
+			total[alloc] += cycles;
+		}
+	}
+
+	dma_set_cache_alloc(1);
+
+	printf("read %d bytes after put\n", NBYTES);
+	printf("without L2 allocation: %lu cycles\n", total[0] / NTRIALS);
+	printf("with L2 allocation:    %lu cycles\n", total[1] / NTRIALS);
+
+	free(src);
+	free(dst);
+	free(flush_buf);
+
+	return 0;
+}
@@ -28,6 +28,7 @@ int main(void)
 	addr.addr = 0;
 	addr.port = PORT;
 	dma_bind_addr(&addr);
+	dma_clear_recv_crc();
 
 	// do a put to our own CPU
 	dma_contig_put(&addr, dst, src, NITEMS);
@@ -39,6 +40,12 @@ int main(void)
 		return -err;
 	}
 
+	if (dma_send_crc() != dma_recv_crc()) {
+		printf("Sent checksum %x does not match received %x\n",
+				dma_send_crc(), dma_recv_crc());
+		err = 1;
+	}
+
 	for (i = 0; i < NITEMS; i++) {
 		if (dst[i] != src[i]) {
 			printf("Expected %d got %d\n", src[i], dst[i]);
@@ -0,0 +1,62 @@
+#include "dma-ext.h"
+
+#define PORT 16
+
+#define N 64
+#define M 16
+
+#define ROW 32
+#define COL 16
+
+int mat_a[N * N];
+int mat_b[M * M];
+
+static int check_transpose(void)
+{
+	int i, j;
+
+	for (i = 0; i < M; i++) {
+		for (j = 0; j < M; j++) {
+			if (mat_b[j * M + i] != mat_a[(ROW + i) * N + COL + j])
+				return 1;
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	int *start;
+	int i, ret;
+	struct dma_addr addr;
+
+	addr.addr = 0;
+	addr.port = PORT;
+	dma_bind_addr(&addr);
+
+	for (i = 0; i < N * N; i++)
+		mat_a[i] = i;
+
+	start = mat_a + ROW * N + COL;
+
+	if (dma_transpose_put(&addr, mat_b, start, sizeof(int), M, M,
+			N * sizeof(int), M * sizeof(int)))
+		return 0x30;
+	dma_fence();
+	ret = dma_send_error();
+	if (ret)
+		return 0x10 | ret;
+
+	if (check_transpose())
+		return 0x20;
+
+	/* a pitch that is not a whole number of elements is refused */
+	if (dma_transpose_put(&addr, mat_b, start, sizeof(int), M, M,
+			N * sizeof(int) + 2, M * sizeof(int)))
+		return 0x31;
+	dma_fence();
+	if (dma_send_error() != DMA_TX_INVALID)
+		return 0x40;
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "dma-ext.h"
+
+#define PORT 100
+#define NBYTES 256
+
+static char window[NBYTES] __attribute__((aligned(64)));
+static char outside[NBYTES] __attribute__((aligned(64)));
+static char src[NBYTES] __attribute__((aligned(64)));
+
+static int put(struct dma_addr *addr, void *dst)
+{
+	dma_contig_put(addr, dst, src, NBYTES);
+	dma_fence();
+	return dma_send_error();
+}
+
+int main(void)
+{
+	struct dma_addr addr;
+	unsigned long rejects;
+	int i, err;
+
+	for (i = 0; i < NBYTES; i++) {
+		src[i] = i;
+		window[i] = 0;
+		outside[i] = 0;
+	}
+
+	addr.addr = 0;
+	addr.port = PORT;
+	dma_bind_addr(&addr);
+
+	dma_register_window(0, window, NBYTES, PORT, 0, DMA_WINDOW_WRITE);
+	dma_check_windows(1);
+
+	err = put(&addr, window);
+	if (err)
+		return 0x10 | err;
+	for (i = 0; i < NBYTES; i++) {
+		if (window[i] != src[i])
+			return 0x18;
+	}
+
+	// outside of the window
+	err = put(&addr, outside);
+	if (err != DMA_TX_NACK)
+		return 0x20 | err;
+	rejects = dma_window_rejects();
+	if (rejects == 0)
+		return 0x28;
+	for (i = 0; i < NBYTES; i++) {
+		if (outside[i] != 0)
+			return 0x2C;
+	}
+
+	// the window is not readable
+	dma_contig_get(&addr, outside, window, NBYTES);
+	dma_fence();
+	err = dma_send_error();
+	if (err != DMA_TX_NACK)
+		return 0x30 | err;
+	if (dma_window_rejects() <= rejects)
+		return 0x38;
+	rejects = dma_window_rejects();
+
+	// only a sender on another port may use the window now
+	dma_register_window(0, window, NBYTES, PORT, PORT + 1,
+			DMA_WINDOW_READ | DMA_WINDOW_WRITE);
+	err = put(&addr, window);
+	if (err != DMA_TX_NACK)
+		return 0x40 | err;
+	if (dma_window_rejects() <= rejects)
+		return 0x48;
+
+	dma_unregister_window(0);
+	dma_check_windows(0);
+
+	err = put(&addr, outside);
+	if (err)
+		return 0x50 | err;
+	for (i = 0; i < NBYTES; i++) {
+		if (outside[i] != src[i])
+			return 0x58;
+	}
+
+	return 0;
+}